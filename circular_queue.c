@@ -5,6 +5,7 @@
  *
  */
 
+#include <string.h>
 #include "circular_queue.h"
 
 /**
@@ -13,10 +14,8 @@
  */
 void initQueue(volatile lnQueue_t* queue)
 {
-    queue->size = QUEUE_SIZE;
     queue->head = 0;
     queue->tail = 0;
-    queue->numEntries = 0;
 }
 
 /**
@@ -26,16 +25,27 @@ void initQueue(volatile lnQueue_t* queue)
  */
 bool isQueueEmpty(volatile lnQueue_t* queue)
 {
-    return (queue->numEntries == 0);
+    return (queue->head == queue->tail);
 }
 
 /**
  * check if the queue is full
  * @param q: name of the queue (pass the address of the queue)
  * @return true: if queue is full, false; if queue is not full
- */bool isQueueFull(volatile lnQueue_t* queue)
+ */
+bool isQueueFull(volatile lnQueue_t* queue)
 {
-    return (queue->numEntries == queue->size);
+    return (((queue->tail + 1) & QUEUE_MASK) == queue->head);
+}
+
+/**
+ * get the number of values on the queue
+ * @param queue: name of the queue (pass the address of the queue)
+ * @return the number of values on the queue
+ */
+uint8_t getNumEntries(volatile lnQueue_t* queue)
+{
+    return ((queue->tail - queue->head) & QUEUE_MASK);
 }
 
 /**
@@ -47,17 +57,19 @@ bool isQueueEmpty(volatile lnQueue_t* queue)
 bool enQueue(volatile lnQueue_t* queue, uint8_t value)
 {
     // put a value on the queue
-    if (isQueueFull(queue))
+    uint8_t tail = queue->tail;
+    uint8_t next = (tail + 1) & QUEUE_MASK;
+    if (next == queue->head)
     {
        // return false if queue is full
        return false;
     }
     else
     {
-        // put the value to the queue and return true
-        queue->values[queue->tail] = value;
-        queue->numEntries++;
-        queue->tail = (queue->tail + 1) % queue->size;
+        // first store the value, then publish it to the consumer by
+        // moving the tail
+        queue->values[tail] = value;
+        queue->tail = next;
         return true;
     }
 }
@@ -70,45 +82,193 @@ bool enQueue(volatile lnQueue_t* queue, uint8_t value)
 bool deQueue(volatile lnQueue_t* queue)
 {
     // get a value from the queue
-    if (isQueueEmpty(queue))
+    uint8_t head = queue->head;
+    if (head == queue->tail)
     {
         // return false if queue is empty
         return false;
     }
     else
     {
-        // set the values and return true
-        queue->head = (queue->head + 1) % queue->size;
-        queue->numEntries--;
+        // release the value to the producer by moving the head
+        queue->head = (head + 1) & QUEUE_MASK;
         return true;
     }
 }
 
 /**
- * clear the content of the queue
+ * clear the content of the queue (called by the consumer)
  * @param lnQueue: name of the queue (pass the address of the queue)
  */
 void clearQueue(volatile lnQueue_t* lnQueue)
 {
-    while (!isQueueEmpty(lnQueue))
+    lnQueue->head = lnQueue->tail;
+}
+
+// <editor-fold defaultstate="collapsed" desc="message queue">
+
+/**
+ * initialise the message queue
+ * @param queue: name of the queue (pass the address of the queue)
+ */
+void initMessageQueue(volatile lnMessageQueue_t* queue)
+{
+    initQueue(&queue->bytes);
+    queue->msgHead = 0;
+    queue->msgTail = 0;
+    queue->cursor = 0;
+}
+
+/**
+ * check if the message queue is empty
+ * @param queue: name of the queue (pass the address of the queue)
+ * @return true: if there is no (complete) message on the queue
+ */
+bool isMessageQueueEmpty(volatile lnMessageQueue_t* queue)
+{
+    return (queue->msgHead == queue->msgTail);
+}
+
+/**
+ * check if there is room for a message (called by the producer)
+ * @param queue: name of the queue (pass the address of the queue)
+ * @param length: the length of the message
+ * @return true: if the message fits on the queue
+ */
+bool reserveMessage(volatile lnMessageQueue_t* queue, uint8_t length)
+{
+    return ((((queue->msgTail + 1) & MESSAGE_QUEUE_MASK) != queue->msgHead) &&
+            (length <= ((queue->bytes.head - queue->bytes.tail - 1) & QUEUE_MASK)));
+}
+
+/**
+ * write a byte of a reserved message (the message is not yet published)
+ * @param queue: name of the queue (pass the address of the queue)
+ * @param offset: the position of the byte in the message
+ * @param value: the value of the byte
+ */
+void writeMessageByte(volatile lnMessageQueue_t* queue, uint8_t offset, uint8_t value)
+{
+    queue->bytes.values[(queue->bytes.tail + offset) & QUEUE_MASK] = value;
+}
+
+/**
+ * publish a reserved and written message to the consumer
+ * @param queue: name of the queue (pass the address of the queue)
+ * @param length: the length of the message
+ */
+void commitMessage(volatile lnMessageQueue_t* queue, uint8_t length)
+{
+    uint8_t msgTail = queue->msgTail;
+    queue->lengths[msgTail] = length;
+    queue->bytes.tail = (queue->bytes.tail + length) & QUEUE_MASK;
+    queue->msgTail = (msgTail + 1) & MESSAGE_QUEUE_MASK;
+}
+
+/**
+ * put a complete message on the queue
+ * @param queue: name of the queue (pass the address of the queue)
+ * @param message: the bytes of the message
+ * @param length: the length of the message
+ * @return true: if the message is put on the queue, false: if there is no
+ * room for the message (nothing is put on the queue)
+ */
+bool enQueueMessage(volatile lnMessageQueue_t* queue, const uint8_t* message, uint8_t length)
+{
+    if (length == 0 || !reserveMessage(queue, length))
     {
-        deQueue(lnQueue);
+        return false;
+    }
+    // copy the message in one block, or in two if it wraps around the end
+    // of the queue
+    uint8_t tail = queue->bytes.tail;
+    uint8_t first = QUEUE_SIZE - tail;
+    if (first > length)
+    {
+        first = length;
     }
+    memcpy((void*)&queue->bytes.values[tail], message, first);
+    memcpy((void*)queue->bytes.values, message + first, length - first);
+    commitMessage(queue, length);
+    return true;
 }
 
 /**
- * recover the LN message by setting the head to the begin of the LN message
- * @param lnQueue: name of the queue (pass the address of the queue)
+ * get the length of the message at the head of the queue
+ * @param queue: name of the queue (pass the address of the queue)
+ * @return the length of the message, 0 if the queue is empty
  */
-void recoverLnMessage(volatile lnQueue_t* lnQueue)
+uint8_t getMessageLength(volatile lnMessageQueue_t* queue)
 {
-    if (!isQueueEmpty(lnQueue))
+    if (isMessageQueueEmpty(queue))
     {
-        // rewind head to the begin of the LN message
-        while ((lnQueue->values[lnQueue->head] & 0x80) != 0x80)
-        {
-            lnQueue->head = (lnQueue->head - 1) % lnQueue->size;
-            lnQueue->numEntries++;
-        }        
+        return 0;
     }
+    return queue->lengths[queue->msgHead];
+}
+
+/**
+ * get a byte of the message at the head of the queue
+ * @param queue: name of the queue (pass the address of the queue)
+ * @param offset: the position of the byte in the message
+ * @return the value of the byte
+ */
+uint8_t getMessageByte(volatile lnMessageQueue_t* queue, uint8_t offset)
+{
+    return queue->bytes.values[(queue->bytes.head + offset) & QUEUE_MASK];
 }
+
+/**
+ * get the byte at the cursor of the message at the head of the queue
+ * @param queue: name of the queue (pass the address of the queue)
+ * @return the value of the byte
+ */
+uint8_t getNextMessageByte(volatile lnMessageQueue_t* queue)
+{
+    return getMessageByte(queue, queue->cursor);
+}
+
+/**
+ * move the cursor to the next byte of the head message, the message is
+ * removed from the queue after its last byte
+ * @param queue: name of the queue (pass the address of the queue)
+ * @return true: if the cursor is moved, false: if the queue is empty
+ */
+bool deQueueMessageByte(volatile lnMessageQueue_t* queue)
+{
+    if (isMessageQueueEmpty(queue))
+    {
+        return false;
+    }
+    if (++queue->cursor == queue->lengths[queue->msgHead])
+    {
+        deQueueMessage(queue);
+    }
+    return true;
+}
+
+/**
+ * remove the message at the head of the queue
+ * @param queue: name of the queue (pass the address of the queue)
+ */
+void deQueueMessage(volatile lnMessageQueue_t* queue)
+{
+    uint8_t msgHead = queue->msgHead;
+    if (msgHead != queue->msgTail)
+    {
+        queue->cursor = 0;
+        queue->bytes.head = (queue->bytes.head + queue->lengths[msgHead]) & QUEUE_MASK;
+        queue->msgHead = (msgHead + 1) & MESSAGE_QUEUE_MASK;
+    }
+}
+
+/**
+ * recover the LN message by setting the cursor to the begin of the message
+ * @param lnQueue: name of the queue (pass the address of the queue)
+ */
+void recoverLnMessage(volatile lnMessageQueue_t* lnQueue)
+{
+    lnQueue->cursor = 0;
+}
+
+// </editor-fold>
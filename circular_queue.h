@@ -5,6 +5,8 @@
  *
  * revision history:
  *  v1.0 Creation (14/01/2024 15:28)
+ *  v1.1 lock-free single-producer/single-consumer queue (16/10/2026)
+ *  v1.2 message queue with O(1) message framing (16/10/2026)
  */
 
 #ifndef CIRCULAR_QUEUE_H
@@ -13,24 +15,68 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+// the size of the queue must be a power of 2 (indices are masked) and may
+// not exceed 128 (uint8_t indices), one entry is kept free to distinguish a
+// full queue from an empty queue
 #define QUEUE_SIZE 128
+#define QUEUE_MASK (QUEUE_SIZE - 1)
 
+#if (QUEUE_SIZE & QUEUE_MASK) != 0 || QUEUE_SIZE > 128
+#error "QUEUE_SIZE must be a power of 2 and not larger than 128"
+#endif
+
+// the maximum number of LN messages on a message queue (power of 2, one
+// entry is kept free)
+#define MESSAGE_QUEUE_SIZE 32
+#define MESSAGE_QUEUE_MASK (MESSAGE_QUEUE_SIZE - 1)
+
+#if (MESSAGE_QUEUE_SIZE & MESSAGE_QUEUE_MASK) != 0 || MESSAGE_QUEUE_SIZE > 128
+#error "MESSAGE_QUEUE_SIZE must be a power of 2 and not larger than 128"
+#endif
+
+// single-producer/single-consumer queue: the producer only writes the tail
+// and the consumer only writes the head, so the queue can be shared between
+// the main context and the ISR without disabling the interrupts
 typedef struct lnQueue_t
 {
-    uint8_t head;
-    uint8_t tail;
-    uint8_t numEntries;
-    uint8_t size;
+    uint8_t head;               // written by the consumer only
+    uint8_t tail;               // written by the producer only
     uint8_t values[QUEUE_SIZE];
 } lnQueue_t;
 
+// message queue: a queue of bytes with the length of every LN message, so
+// complete LN messages can be put on, peeked, rewound and removed from the
+// queue without scanning for the start byte (msb = 1) of the next message
+// the producer writes the bytes first and publishes the message by moving
+// msgTail, the consumer reads the head message with a cursor
+typedef struct lnMessageQueue_t
+{
+    lnQueue_t bytes;            // the bytes of the messages
+    uint8_t msgHead;            // written by the consumer only
+    uint8_t msgTail;            // written by the producer only
+    uint8_t cursor;             // next byte of the head message (consumer)
+    uint8_t lengths[MESSAGE_QUEUE_SIZE];
+} lnMessageQueue_t;
+
 void initQueue(volatile lnQueue_t*);
 bool isQueueEmpty(volatile lnQueue_t*);
 bool isQueueFull(volatile lnQueue_t*);
+uint8_t getNumEntries(volatile lnQueue_t*);
 bool enQueue(volatile lnQueue_t*, uint8_t);
 bool deQueue(volatile lnQueue_t*);
 void clearQueue(volatile lnQueue_t*);
-void recoverLnMessage(volatile lnQueue_t*);
 
-#endif	/* CIRCULAR_QUEUE_H */
+void initMessageQueue(volatile lnMessageQueue_t*);
+bool isMessageQueueEmpty(volatile lnMessageQueue_t*);
+bool reserveMessage(volatile lnMessageQueue_t*, uint8_t);
+void writeMessageByte(volatile lnMessageQueue_t*, uint8_t, uint8_t);
+void commitMessage(volatile lnMessageQueue_t*, uint8_t);
+bool enQueueMessage(volatile lnMessageQueue_t*, const uint8_t*, uint8_t);
+uint8_t getMessageLength(volatile lnMessageQueue_t*);
+uint8_t getMessageByte(volatile lnMessageQueue_t*, uint8_t);
+uint8_t getNextMessageByte(volatile lnMessageQueue_t*);
+bool deQueueMessageByte(volatile lnMessageQueue_t*);
+void deQueueMessage(volatile lnMessageQueue_t*);
+void recoverLnMessage(volatile lnMessageQueue_t*);
 
+#endif	/* CIRCULAR_QUEUE_H */
@@ -14,7 +14,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-unsigned long _XTAL_FREQ = 32000000u;
+#define _XTAL_FREQ 32000000u    // for __delay_ms()
     
 // CONFIG1H
 #pragma config OSC = INTIO67    // Oscillator Selection bits (Internal oscillator block, port function on RA6 and RA7)
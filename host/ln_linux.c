@@ -0,0 +1,330 @@
+/*
+ * file: ln_linux.c
+ * author: Geert Giebens, Jan van Hooydonk
+ * comments: LocoNet driver - hardware hooks of a Linux serial device
+ *
+ */
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+// termios2 (any baudrate), <termios.h> can not be included next to it
+#include <asm/termbits.h>
+
+#include "ln_linux.h"
+
+const lnPortHal_t lnLinuxHal =
+{
+    .init = lnLinuxInit,
+    .isLineFree = lnLinuxIsLineFree,
+    .writeTx = lnLinuxWriteTx,
+    .setBRG = lnLinuxSetBRG,
+    .setLinebreak = lnLinuxSetLinebreak,
+    .startTimer = lnLinuxStartTimer,
+    .stopTimer = lnLinuxStopTimer,
+    .wakeTimer = lnLinuxWakeTimer,
+    .lockIsr = lnLinuxLockIsr,
+    .unlockIsr = lnLinuxUnlockIsr,
+    .setLed = lnLinuxSetLed,
+#if LN_TIME
+    .getTime = lnLinuxGetTime,
+#endif
+#if LN_TRACE
+    .getMicros = lnLinuxGetMicros,
+#endif
+};
+
+// <editor-fold defaultstate="collapsed" desc="device">
+
+/**
+ * open and configure the serial device (16.66 kbaud 8N1, raw, breaks and
+ * framing errors marked in the data as \377 \0 x)
+ * @param serial: the state of the device
+ * @param device: the path of the device (eg. /dev/ttyUSB0 or a pty)
+ * @return 0: if the device is ready, -1: on error (see errno)
+ */
+int lnLinuxOpen(lnLinux_t* serial, const char* device)
+{
+    struct termios2 tio;
+
+    serial->fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (serial->fd < 0)
+    {
+        return -1;
+    }
+    if (ioctl(serial->fd, TCGETS2, &tio) < 0)
+    {
+        close(serial->fd);
+        return -1;
+    }
+    // mark breaks and framing errors (n_tty only marks a framing error
+    // with INPCK, IGNPAR stays clear)
+    tio.c_iflag = PARMRK | INPCK;
+    tio.c_oflag = 0;
+    tio.c_lflag = 0;
+    tio.c_cflag = CS8 | CREAD | CLOCAL | BOTHER;
+    tio.c_ispeed = LN_LINUX_BAUDRATE;
+    tio.c_ospeed = LN_LINUX_BAUDRATE;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    if (ioctl(serial->fd, TCSETS2, &tio) < 0)
+    {
+        close(serial->fd);
+        return -1;
+    }
+    serial->linebreak = false;
+    serial->tmr1On = false;
+    serial->mark = 0;
+    return 0;
+}
+
+/**
+ * get the time (monotonic clock)
+ * @return the time in s
+ */
+uint64_t lnLinuxNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+}
+
+/**
+ * read the received bytes and hand them to the driver (the top half and
+ * the bottom half of the EUSART RC interrupt), at most LN_LINUX_READ bytes
+ * per call, so the trace ring (LN_TRACE) can be read in between
+ * @param port: the LN port
+ */
+void lnLinuxRead(lnPort_t* port)
+{
+    lnLinux_t* serial = port->context;
+    uint8_t buffer[LN_LINUX_READ];
+    ssize_t count;
+
+    if ((count = read(serial->fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (ssize_t i = 0; i < count; i++)
+        {
+            uint8_t value = buffer[i];
+            uint8_t event = LN_RAW_DATA;
+            // PARMRK: \377 \377 is a data byte 0xff, \377 \0 x is a break
+            // or a framing error
+            if (serial->mark == 0 && value == 0xff)
+            {
+                serial->mark = 1;
+                continue;
+            }
+            if (serial->mark == 1 && value == 0x00)
+            {
+                serial->mark = 2;
+                continue;
+            }
+            if (serial->mark == 2)
+            {
+                event = LN_RAW_FERR;
+            }
+            serial->mark = 0;
+            if (!serial->linebreak)
+            {
+                // the EUSART is stopped during a linebreak of the driver,
+                // the bottom half runs for every byte (the raw ring is
+                // smaller than the buffer)
+                pushRaw(port, value, event);
+                lnIsrRaw(port);
+            }
+        }
+    }
+}
+
+/**
+ * run the timer 1 interrupt if timer 1 overflowed
+ * @param port: the LN port
+ */
+void lnLinuxRunTimer(lnPort_t* port)
+{
+    lnLinux_t* serial = port->context;
+    if (serial->tmr1On && lnLinuxNow() >= serial->tmr1Expiry)
+    {
+        // the timer keeps running after the overflow, unless the driver
+        // restarts or stops it
+        serial->tmr1Expiry += LN_LINUX_TMR1_PERIOD;
+        lnIsrTmr1(port);
+    }
+}
+
+/**
+ * get the time until the next timer 1 overflow
+ * @param port: the LN port
+ * @return the time in s, -1: if timer 1 is stopped
+ */
+int64_t lnLinuxGetTimeout(lnPort_t* port)
+{
+    lnLinux_t* serial = port->context;
+    if (!serial->tmr1On)
+    {
+        return -1;
+    }
+    uint64_t now = lnLinuxNow();
+    return (serial->tmr1Expiry > now) ? (int64_t)(serial->tmr1Expiry - now) : 0;
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="hardware hooks">
+
+/**
+ * initialise the hardware of the LN port (the device is opened by
+ * lnLinuxOpen)
+ * @param port: the LN port
+ */
+void lnLinuxInit(lnPort_t* port)
+{
+    lnLinux_t* serial = port->context;
+    serial->tmr1On = false;
+#if LN_TIMEBASE
+    port->timeEpoch = 0;
+#endif
+}
+
+/**
+ * check if the LocoNet is free: no linebreak and no received data waiting
+ * (the UART hands over complete bytes only, so a byte in reception is not
+ * visible, every received byte restarts the CMP delay of the driver)
+ * @param port: the LN port
+ * @return true: if the line is free, false: if the line is occupied
+ */
+bool lnLinuxIsLineFree(lnPort_t* port)
+{
+    lnLinux_t* serial = port->context;
+    int waiting = 0;
+    ioctl(serial->fd, FIONREAD, &waiting);
+    return (!serial->linebreak && waiting == 0);
+}
+
+/**
+ * transmit a byte
+ * @param port: the LN port
+ * @param value: the byte
+ */
+void lnLinuxWriteTx(lnPort_t* port, uint8_t value)
+{
+    lnLinux_t* serial = port->context;
+    // a lost byte is detected by the echo check of the driver
+    (void)!write(serial->fd, &value, 1);
+}
+
+/**
+ * the baudrate generator is not accessible (the UART of the device
+ * synchronises on every start bit)
+ * @param port: the LN port
+ */
+void lnLinuxSetBRG(lnPort_t* port)
+{
+}
+
+/**
+ * start or end a linebreak
+ * @param port: the LN port
+ * @param on: true: pull LN low (break) and ignore the received data,
+ * false: release LN
+ */
+void lnLinuxSetLinebreak(lnPort_t* port, bool on)
+{
+    lnLinux_t* serial = port->context;
+    // a pty has no break condition, the request is ignored
+    ioctl(serial->fd, on ? TIOCSBRK : TIOCCBRK);
+    serial->linebreak = on;
+    serial->mark = 0;
+}
+
+/**
+ * (re-)start timer 1 with a delay
+ * @param port: the LN port
+ * @param time: the delay in s
+ */
+void lnLinuxStartTimer(lnPort_t* port, uint16_t time)
+{
+    lnLinux_t* serial = port->context;
+    serial->tmr1Expiry = lnLinuxNow() + time;
+    serial->tmr1On = true;
+}
+
+/**
+ * stop timer 1
+ * @param port: the LN port
+ */
+void lnLinuxStopTimer(lnPort_t* port)
+{
+    lnLinux_t* serial = port->context;
+    serial->tmr1On = false;
+}
+
+/**
+ * start a stopped timer 1 and let it overflow right away
+ * @param port: the LN port
+ */
+void lnLinuxWakeTimer(lnPort_t* port)
+{
+    lnLinux_t* serial = port->context;
+    if (!serial->tmr1On)
+    {
+        serial->tmr1Expiry = lnLinuxNow();
+        serial->tmr1On = true;
+    }
+}
+
+/**
+ * the "ISRs" run in the thread of the main context (lnLinuxRead,
+ * lnLinuxRunTimer), there is nothing to disable
+ * @param port: the LN port
+ * @return 0
+ */
+uint8_t lnLinuxLockIsr(lnPort_t* port)
+{
+    return 0;
+}
+
+/**
+ * see lnLinuxLockIsr
+ * @param port: the LN port
+ * @param state: the state returned by lnLinuxLockIsr
+ */
+void lnLinuxUnlockIsr(lnPort_t* port, uint8_t state)
+{
+}
+
+/**
+ * there is no led 'data on LN'
+ * @param port: the LN port
+ * @param on: true: led on
+ */
+void lnLinuxSetLed(lnPort_t* port, bool on)
+{
+}
+
+#if LN_TIME
+/**
+ * get the time of the monotonic clock
+ * @param port: the LN port
+ * @return the time in units of 256s
+ */
+uint16_t lnLinuxGetTime(lnPort_t* port)
+{
+    return (uint16_t)(lnLinuxNow() >> 8);
+}
+#endif
+
+#if LN_TRACE
+/**
+ * get the time of the monotonic clock
+ * @param port: the LN port
+ * @return the time in s
+ */
+uint32_t lnLinuxGetMicros(lnPort_t* port)
+{
+    return (uint32_t)lnLinuxNow();
+}
+#endif
+
+// </editor-fold>
@@ -0,0 +1,64 @@
+/*
+ * file: ln_linux.h
+ * author: Geert Giebens, Jan van Hooydonk
+ * comments: LocoNet driver - hardware hooks of a Linux serial device
+ *
+ * the LN port on a serial device (eg. an USB-UART with a LocoNet line
+ * driver) or on a pty. The device runs at 16.66 kbaud 8N1 and must echo
+ * the transmitted bytes, as LocoNet does. There are no interrupts: the
+ * event loop of the application calls lnLinuxRead when the device is
+ * readable and lnLinuxRunTimer when the timeout of lnLinuxGetTimeout is
+ * over (see lnbridge.c).
+ *
+ * revision history:
+ *  v1.0 Creation (16/10/2026)
+ */
+
+#ifndef LN_LINUX_H
+#define	LN_LINUX_H
+
+#include "../ln.h"
+
+#define LN_LINUX_BAUDRATE 16666
+#define LN_LINUX_READ 32u           // bytes read per lnLinuxRead
+#define LN_LINUX_TMR1_PERIOD 0x10000u
+                                    // timer 1 overflows every 65.536ms if
+                                    // the driver does not restart it
+
+// the state of the serial device (the context of the LN port)
+typedef struct lnLinux_t
+{
+    int fd;                         // serial device (non-blocking)
+    bool linebreak;                 // LN pulled low, receiver disabled
+    bool tmr1On;                    // timer 1 is running
+    uint64_t tmr1Expiry;            // time of the timer 1 overflow (s)
+    uint8_t mark;                   // bytes of a PARMRK sequence (\377 \0 x)
+} lnLinux_t;
+
+extern const lnPortHal_t lnLinuxHal;
+
+int lnLinuxOpen(lnLinux_t*, const char*);
+uint64_t lnLinuxNow(void);
+void lnLinuxRead(lnPort_t*);
+void lnLinuxRunTimer(lnPort_t*);
+int64_t lnLinuxGetTimeout(lnPort_t*);
+
+void lnLinuxInit(lnPort_t*);
+bool lnLinuxIsLineFree(lnPort_t*);
+void lnLinuxWriteTx(lnPort_t*, uint8_t);
+void lnLinuxSetBRG(lnPort_t*);
+void lnLinuxSetLinebreak(lnPort_t*, bool);
+void lnLinuxStartTimer(lnPort_t*, uint16_t);
+void lnLinuxStopTimer(lnPort_t*);
+void lnLinuxWakeTimer(lnPort_t*);
+uint8_t lnLinuxLockIsr(lnPort_t*);
+void lnLinuxUnlockIsr(lnPort_t*, uint8_t);
+void lnLinuxSetLed(lnPort_t*, bool);
+#if LN_TIME
+uint16_t lnLinuxGetTime(lnPort_t*);
+#endif
+#if LN_TRACE
+uint32_t lnLinuxGetMicros(lnPort_t*);
+#endif
+
+#endif	/* LN_LINUX_H */
@@ -0,0 +1,72 @@
+/*
+ * file: ln_trace.h
+ * author: Geert Giebens, Jan van Hooydonk
+ * comments: LocoNet driver - trace file format
+ *
+ * a trace file is a header of 8 bytes followed by the records of the trace
+ * ring of the driver (lnTraceRecord_t, 4 bytes), as they are:
+ *  header: 'L' 'N' 'T' 'R', version (1), record size (4), 0, 0
+ *  record: delta (s since the previous record, lsb first), event, value
+ *  event:  LN_RAW_DATA (0): a received byte (value)
+ *          LN_RAW_FERR (1): a framing error (linebreak), value = the byte
+ *          LN_RAW_OERR (2): a receiver overrun (a byte is lost)
+ *          LN_TRACE_IDLE (3): no event, delta = bits 23 ... 16 of the gap
+ *          to the next record
+ * a dump of the trace ring of the firmware (from head to tail) is a valid
+ * trace file body
+ *
+ * revision history:
+ *  v1.0 Creation (16/10/2026)
+ */
+
+#ifndef LN_TRACE_H
+#define	LN_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LN_TRACE_FILE_VERSION 1
+#define LN_TRACE_FILE_HEADER 8u
+#define LN_TRACE_RECORD 4u
+
+// the events of a trace record (the same as the events of the raw ring)
+#define LN_TRACE_DATA 0
+#define LN_TRACE_FERR 1
+#define LN_TRACE_OERR 2
+#ifndef LN_TRACE_IDLE
+#define LN_TRACE_IDLE 3
+#endif
+
+static inline void lnTraceFileHeader(uint8_t* header)
+{
+    memcpy(header, "LNTR", 4);
+    header[4] = LN_TRACE_FILE_VERSION;
+    header[5] = LN_TRACE_RECORD;
+    header[6] = 0;
+    header[7] = 0;
+}
+
+/**
+ * check the header of a trace file
+ * @param header: the first LN_TRACE_FILE_HEADER bytes of the file
+ * @return true: if the file is a trace file of this version
+ */
+static inline bool lnTraceFileCheck(const uint8_t* header)
+{
+    return (memcmp(header, "LNTR", 4) == 0 && header[4] == LN_TRACE_FILE_VERSION &&
+            header[5] == LN_TRACE_RECORD);
+}
+
+/**
+ * get the delta of a trace record (a LN_TRACE_IDLE record gives the upper
+ * bits of the gap, they add up with the delta of the next record)
+ * @param record: the record (LN_TRACE_RECORD bytes)
+ * @return the delta in s
+ */
+static inline uint32_t lnTraceDelta(const uint8_t* record)
+{
+    return (record[0] | ((uint32_t)record[1] << 8)) << ((record[2] == LN_TRACE_IDLE) ? 16 : 0);
+}
+
+#endif	/* LN_TRACE_H */
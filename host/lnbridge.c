@@ -0,0 +1,754 @@
+/*
+ * file: lnbridge.c
+ * author: Geert Giebens, Jan van Hooydonk
+ * comments: LocoNet driver - LbServer compatible TCP bridge
+ *
+ * runs the LocoNet driver (CMP delay, echo check, linebreaks, ...) on a
+ * Linux serial device and serves the bus over TCP with the LbServer
+ * (LocoNetOverTcp) text protocol, eg. for JMRI:
+ *  client -> bridge: SEND <hex bytes>
+ *  bridge -> client: VERSION <text>, RECEIVE <hex bytes>, SENT OK,
+ *                    SENT ERROR <reason>
+ *
+ * every LN message on the bus (also the ones sent by the clients) is
+ * formatted once as a RECEIVE line in a broadcast ring, every client only
+ * has a cursor in the ring. The SEND lines of all clients that are read in
+ * one round of the event loop are put on the LN TX queue together, the
+ * client gets SENT OK when the echo of the LN message is verified, the
+ * replies to a client follow the order of its SEND lines (a SENT ERROR
+ * waits for the SENT OK of the LN messages before it). If the
+ * LN TX queue is full, the remaining lines of a client wait (and its input
+ * is not read) until LN messages are transmitted.
+ *
+ * with -P the bridge creates a pty pair and runs the driver on the slave,
+ * the master echoes every byte like a LocoNet bus with a single node, so
+ * the bridge can be tested without interface hardware:
+ *  ./lnbridge -P -p 1234 &
+ *  printf 'SEND B2 00 00 4D\n' | nc -q 1 localhost 1234
+ *
+ * with -T the received bytes are written to a trace file (see ln_trace.h)
+ * that can be replayed into the driver with lnreplay
+ *
+ * usage: lnbridge [-d device | -P] [-p port] [-T trace]
+ *
+ * revision history:
+ *  v1.0 Creation (16/10/2026)
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "ln_linux.h"
+#include "ln_trace.h"
+
+#define LN_BRIDGE_PORT 1234
+#define LN_BRIDGE_MAX_CLIENTS 256u
+#define LN_BRIDGE_RING_SIZE 0x10000u    // broadcast ring (power of 2)
+#define LN_BRIDGE_RING_MASK (LN_BRIDGE_RING_SIZE - 1)
+#define LN_BRIDGE_LINE_SIZE 512u        // input of a client
+#define LN_BRIDGE_REPLY_SIZE 4096u      // replies to a client (VERSION,
+                                        // SENT), a full line buffer gives
+                                        // less than half of it
+#define LN_BRIDGE_LINE_MAX (8u + 3u * 127u + 2u)
+                                        // RECEIVE line of 127 bytes
+#define LN_BRIDGE_VERSION "VERSION EbpController LocoNet bridge 1.0\r\n"
+
+// <editor-fold defaultstate="collapsed" desc="types">
+
+typedef struct lnBridgeClient_t
+{
+    int fd;                             // -1: not connected
+    uint32_t id;                        // identifies the client in lnBridgeSent
+    uint64_t cursor;                    // next byte of the broadcast ring
+    bool midLine;                       // a RECEIVE line is partly sent
+    bool blocked;                       // waiting for room in the LN TX queue
+    uint16_t lineLength;
+    uint16_t replyLength;
+    char line[LN_BRIDGE_LINE_SIZE];
+    char reply[LN_BRIDGE_REPLY_SIZE];
+} lnBridgeClient_t;
+
+// a LN message of a client on the LN TX queue (waiting for SENT OK), or a
+// refused SEND line (waiting for the SENT OK of the LN messages before it)
+typedef struct lnBridgeSent_t
+{
+    uint32_t client;                    // 0: the client is gone
+    const char* error;                  // NULL: on the LN TX queue
+    uint8_t length;
+    uint8_t message[127];
+} lnBridgeSent_t;
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="bridge state">
+
+static lnLinux_t lnBridgeSerial;
+static lnPort_t lnBridgePort = { .hal = &lnLinuxHal, .context = &lnBridgeSerial };
+static int lnBridgeLoopback = -1;       // pty master of the loopback bus
+static FILE* lnBridgeTrace;             // trace file (-T)
+
+static int lnBridgeListener = -1;
+static lnBridgeClient_t lnBridgeClients[LN_BRIDGE_MAX_CLIENTS];
+static uint32_t lnBridgeNextId = 1;
+
+static char lnBridgeRing[LN_BRIDGE_RING_SIZE];
+static uint64_t lnBridgeRingTail;       // bytes ever put in the ring
+
+// the LN TX queue is a FIFO, so are the LN messages waiting for SENT OK
+static lnBridgeSent_t lnBridgeSent[MESSAGE_QUEUE_SIZE];
+static uint8_t lnBridgeSentHead;
+static uint8_t lnBridgeSentTail;
+static uint16_t lnBridgeTxMessages;     // driver statistic already handled
+
+static volatile sig_atomic_t lnBridgeStop;
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="helpers">
+
+static void lnBridgeSignal(int signal)
+{
+    lnBridgeStop = 1;
+}
+
+static int lnBridgeSetNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return (flags < 0) ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * format a LN message as a line of the protocol
+ * @param line: buffer of LN_BRIDGE_LINE_MAX bytes
+ * @param message: the bytes of the LN message
+ * @param length: the length of the LN message
+ * @return the length of the line
+ */
+static size_t lnBridgeFormat(char* line, const uint8_t* message, uint8_t length)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    size_t n = 0;
+    memcpy(line, "RECEIVE", 7);
+    n = 7;
+    for (uint8_t i = 0; i < length; i++)
+    {
+        line[n++] = ' ';
+        line[n++] = hex[message[i] >> 4];
+        line[n++] = hex[message[i] & 0x0f];
+    }
+    line[n++] = '\r';
+    line[n++] = '\n';
+    return n;
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="clients">
+
+/**
+ * put a line in the broadcast ring (for all clients)
+ * @param line: the line (including \r\n)
+ * @param length: the length of the line
+ */
+static void lnBridgeBroadcast(const char* line, size_t length)
+{
+    size_t start = lnBridgeRingTail & LN_BRIDGE_RING_MASK;
+    size_t first = LN_BRIDGE_RING_SIZE - start;
+    if (first > length)
+    {
+        first = length;
+    }
+    memcpy(&lnBridgeRing[start], line, first);
+    memcpy(lnBridgeRing, line + first, length - first);
+    lnBridgeRingTail += length;
+}
+
+static void lnBridgeBroadcastMessage(const uint8_t* message, uint8_t length)
+{
+    char line[LN_BRIDGE_LINE_MAX];
+    lnBridgeBroadcast(line, lnBridgeFormat(line, message, length));
+}
+
+static void lnBridgeClose(lnBridgeClient_t* client)
+{
+    close(client->fd);
+    client->fd = -1;
+    // the LN messages of the client are still transmitted
+    for (uint8_t i = lnBridgeSentHead; i != lnBridgeSentTail;
+            i = (i + 1) & MESSAGE_QUEUE_MASK)
+    {
+        if (lnBridgeSent[i].client == client->id)
+        {
+            lnBridgeSent[i].client = 0;
+        }
+    }
+}
+
+/**
+ * put a reply in the private buffer of a client
+ * @param client: the client
+ * @param text: the reply (including \r\n)
+ */
+static void lnBridgeReply(lnBridgeClient_t* client, const char* text)
+{
+    size_t length = strlen(text);
+    if (client->replyLength + length > LN_BRIDGE_REPLY_SIZE)
+    {
+        // the input is throttled, so this client does not read at all
+        lnBridgeClose(client);
+        return;
+    }
+    memcpy(&client->reply[client->replyLength], text, length);
+    client->replyLength += (uint16_t)length;
+}
+
+/**
+ * put a reply in the private buffer of a client (if it is still connected)
+ * @param id: the id of the client
+ * @param text: the reply (including \r\n)
+ */
+static void lnBridgeReplyTo(uint32_t id, const char* text)
+{
+    for (unsigned i = 0; i < LN_BRIDGE_MAX_CLIENTS; i++)
+    {
+        if (lnBridgeClients[i].fd >= 0 && lnBridgeClients[i].id == id)
+        {
+            lnBridgeReply(&lnBridgeClients[i], text);
+        }
+    }
+}
+
+static void lnBridgeAccept(void)
+{
+    int fd;
+    while ((fd = accept(lnBridgeListener, NULL, NULL)) >= 0)
+    {
+        lnBridgeClient_t* client = NULL;
+        for (unsigned i = 0; i < LN_BRIDGE_MAX_CLIENTS && client == NULL; i++)
+        {
+            if (lnBridgeClients[i].fd < 0)
+            {
+                client = &lnBridgeClients[i];
+            }
+        }
+        if (client == NULL || lnBridgeSetNonBlocking(fd) < 0)
+        {
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        client->id = lnBridgeNextId++;
+        client->cursor = lnBridgeRingTail;
+        client->midLine = false;
+        client->blocked = false;
+        client->lineLength = 0;
+        client->replyLength = 0;
+        lnBridgeReply(client, LN_BRIDGE_VERSION);
+    }
+}
+
+/**
+ * put a refused SEND line in lnBridgeSent, its SENT ERROR is sent after the
+ * SENT OK of the LN messages before it (see lnBridgeReplyErrors)
+ * @param client: the client
+ * @param error: the reply (including \r\n)
+ * @return true (the line is handled)
+ */
+static bool lnBridgeRefuse(lnBridgeClient_t* client, const char* error)
+{
+    lnBridgeSent_t* sent = &lnBridgeSent[lnBridgeSentTail];
+    sent->client = client->id;
+    sent->error = error;
+    sent->length = 0;
+    lnBridgeSentTail = (lnBridgeSentTail + 1) & MESSAGE_QUEUE_MASK;
+    return true;
+}
+
+/**
+ * handle a SEND line: put the LN message on the LN TX queue
+ * @param client: the client
+ * @param arguments: the hex bytes of the LN message
+ * @return true: if the line is handled, false: if the LN TX queue (or
+ * lnBridgeSent) is full
+ */
+static bool lnBridgeSend(lnBridgeClient_t* client, char* arguments)
+{
+    uint8_t message[127];
+    uint8_t length = 0;
+    uint8_t checksum = 0;
+    uint8_t expected;
+    char* end;
+
+    if (((lnBridgeSentTail + 1) & MESSAGE_QUEUE_MASK) == lnBridgeSentHead)
+    {
+        return false;
+    }
+    for (unsigned long value = strtoul(arguments, &end, 16); end != arguments;
+            value = strtoul(arguments, &end, 16))
+    {
+        if (value > 0xff || length == sizeof(message))
+        {
+            return lnBridgeRefuse(client, "SENT ERROR invalid message\r\n");
+        }
+        message[length++] = (uint8_t)value;
+        checksum ^= (uint8_t)value;
+        arguments = end;
+    }
+    if (length < 2 || (message[0] & 0x80) == 0 || checksum != 0xff)
+    {
+        return lnBridgeRefuse(client, "SENT ERROR invalid message\r\n");
+    }
+    // the length rule of the driver (see lnSendBuiltMessage)
+    expected = LN_OPCODE_LENGTH(message[0]);
+    if (expected == 0)
+    {
+        expected = message[1];
+        if (expected < LN_VARIABLE_MIN_LENGTH)
+        {
+            expected = 0;
+        }
+    }
+    if (expected != length)
+    {
+        return lnBridgeRefuse(client, "SENT ERROR invalid message\r\n");
+    }
+    // wait for room (instead of a refused LN message in the statistics)
+    if (!reserveMessage(&lnBridgePort.txQueue[LN_PRIORITY_NORMAL], length))
+    {
+        return false;
+    }
+    if (!lnSendMessage(&lnBridgePort, message, length))
+    {
+        return lnBridgeRefuse(client, "SENT ERROR LN TX queue full\r\n");
+    }
+    lnBridgeSent_t* sent = &lnBridgeSent[lnBridgeSentTail];
+    sent->client = client->id;
+    sent->error = NULL;
+    sent->length = length;
+    memcpy(sent->message, message, length);
+    lnBridgeSentTail = (lnBridgeSentTail + 1) & MESSAGE_QUEUE_MASK;
+    return true;
+}
+
+/**
+ * handle the complete lines in the input of a client
+ * @param client: the client
+ */
+static void lnBridgeParse(lnBridgeClient_t* client)
+{
+    char* start = client->line;
+    char* end;
+    client->blocked = false;
+    while (client->fd >= 0 && !client->blocked &&
+            (end = memchr(start, '\n', client->lineLength - (start - client->line))) != NULL)
+    {
+        *end = '\0';
+        if (end > start && end[-1] == '\r')
+        {
+            end[-1] = '\0';
+        }
+        if (strncmp(start, "SEND", 4) == 0 && (start[4] == ' ' || start[4] == '\0') &&
+                !lnBridgeSend(client, start + 4))
+        {
+            // keep the line until there is room in the LN TX queue
+            *end = '\n';
+            client->blocked = true;
+            break;
+        }
+        // other commands are ignored
+        start = end + 1;
+    }
+    if (client->fd < 0)
+    {
+        return;
+    }
+    client->lineLength -= (uint16_t)(start - client->line);
+    if (!client->blocked && client->lineLength == LN_BRIDGE_LINE_SIZE)
+    {
+        // a line without end, discard it
+        client->lineLength = 0;
+    }
+    memmove(client->line, start, client->lineLength);
+}
+
+/**
+ * read the input of a client
+ * @param client: the client
+ */
+static void lnBridgeRead(lnBridgeClient_t* client)
+{
+    ssize_t count = read(client->fd, &client->line[client->lineLength],
+            LN_BRIDGE_LINE_SIZE - client->lineLength);
+    if (count == 0 || (count < 0 && errno != EAGAIN && errno != EINTR))
+    {
+        lnBridgeClose(client);
+        return;
+    }
+    if (count > 0)
+    {
+        client->lineLength += (uint16_t)count;
+        lnBridgeParse(client);
+    }
+}
+
+/**
+ * send the replies and the broadcast ring to a client, a reply is only sent
+ * between two RECEIVE lines
+ * @param client: the client
+ */
+static void lnBridgeWrite(lnBridgeClient_t* client)
+{
+    if (lnBridgeRingTail - client->cursor > LN_BRIDGE_RING_SIZE)
+    {
+        // the client is too slow, the ring has overwritten its data
+        lnBridgeClose(client);
+        return;
+    }
+    if (!client->midLine && client->replyLength != 0)
+    {
+        ssize_t count = send(client->fd, client->reply, client->replyLength, MSG_NOSIGNAL);
+        if (count < 0)
+        {
+            if (errno != EAGAIN && errno != EINTR)
+            {
+                lnBridgeClose(client);
+            }
+            return;
+        }
+        client->replyLength -= (uint16_t)count;
+        memmove(client->reply, &client->reply[count], client->replyLength);
+        if (client->replyLength != 0)
+        {
+            return;
+        }
+    }
+    if (client->cursor != lnBridgeRingTail)
+    {
+        // send straight from the ring (in two parts if it wraps)
+        size_t start = client->cursor & LN_BRIDGE_RING_MASK;
+        size_t length = lnBridgeRingTail - client->cursor;
+        struct iovec iov[2];
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 1 };
+        iov[0].iov_base = &lnBridgeRing[start];
+        iov[0].iov_len = length;
+        if (start + length > LN_BRIDGE_RING_SIZE)
+        {
+            iov[0].iov_len = LN_BRIDGE_RING_SIZE - start;
+            iov[1].iov_base = lnBridgeRing;
+            iov[1].iov_len = length - iov[0].iov_len;
+            msg.msg_iovlen = 2;
+        }
+        ssize_t count = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+        if (count < 0)
+        {
+            if (errno != EAGAIN && errno != EINTR)
+            {
+                lnBridgeClose(client);
+            }
+            return;
+        }
+        client->cursor += (uint64_t)count;
+        client->midLine = (count != 0 &&
+                lnBridgeRing[(client->cursor - 1) & LN_BRIDGE_RING_MASK] != '\n');
+    }
+}
+
+static bool lnBridgeHasOutput(lnBridgeClient_t* client)
+{
+    return (client->replyLength != 0 || client->cursor != lnBridgeRingTail);
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="bus">
+
+/**
+ * send the SENT ERROR of the refused SEND lines at the head of lnBridgeSent
+ * (the LN messages before them are transmitted)
+ */
+static void lnBridgeReplyErrors(void)
+{
+    while (lnBridgeSentHead != lnBridgeSentTail &&
+            lnBridgeSent[lnBridgeSentHead].error != NULL)
+    {
+        lnBridgeSent_t* sent = &lnBridgeSent[lnBridgeSentHead];
+        lnBridgeSentHead = (lnBridgeSentHead + 1) & MESSAGE_QUEUE_MASK;
+        lnBridgeReplyTo(sent->client, sent->error);
+    }
+}
+
+/**
+ * broadcast the LN messages received by the driver and the LN messages of
+ * the clients that are transmitted (echo verified)
+ * @return true: if LN messages of the LN TX queue are transmitted (or
+ * refused SEND lines are answered)
+ */
+static bool lnBridgeUpdateBus(void)
+{
+    uint8_t message[127];
+    uint8_t length;
+    uint8_t sentHead = lnBridgeSentHead;
+    bool transmitted = (lnBridgeTxMessages != lnBridgePort.stats.txMessages);
+
+    lnBridgeReplyErrors();
+    while (lnBridgeTxMessages != lnBridgePort.stats.txMessages)
+    {
+        lnBridgeSent_t* sent = &lnBridgeSent[lnBridgeSentHead];
+        lnBridgeTxMessages++;
+        if (lnBridgeSentHead == lnBridgeSentTail)
+        {
+            continue;
+        }
+        lnBridgeSentHead = (lnBridgeSentHead + 1) & MESSAGE_QUEUE_MASK;
+        lnBridgeBroadcastMessage(sent->message, sent->length);
+        lnBridgeReplyTo(sent->client, "SENT OK\r\n");
+        lnBridgeReplyErrors();
+    }
+    while ((length = lnReceiveMessage(&lnBridgePort, message, sizeof(message))) != 0)
+    {
+        lnBridgeBroadcastMessage(message, length);
+    }
+    return transmitted || lnBridgeSentHead != sentHead;
+}
+
+/**
+ * the loopback bus: echo every byte of the driver (a bus with one node)
+ */
+static void lnBridgeEcho(void)
+{
+    uint8_t buffer[256];
+    ssize_t count;
+    while ((count = read(lnBridgeLoopback, buffer, sizeof(buffer))) > 0)
+    {
+        (void)!write(lnBridgeLoopback, buffer, (size_t)count);
+    }
+}
+
+static int lnBridgeOpenLoopback(void)
+{
+    lnBridgeLoopback = posix_openpt(O_RDWR | O_NOCTTY);
+    if (lnBridgeLoopback < 0 || grantpt(lnBridgeLoopback) < 0 ||
+            unlockpt(lnBridgeLoopback) < 0 || lnBridgeSetNonBlocking(lnBridgeLoopback) < 0)
+    {
+        return -1;
+    }
+    const char* device = ptsname(lnBridgeLoopback);
+    if (device == NULL || lnLinuxOpen(&lnBridgeSerial, device) < 0)
+    {
+        return -1;
+    }
+    fprintf(stderr, "lnbridge: loopback bus on %s\n", device);
+    return 0;
+}
+
+/**
+ * write the records of the trace ring of the driver to the trace file
+ */
+static void lnBridgeWriteTrace(void)
+{
+    lnTraceRecord_t records[LN_TRACE_SIZE];
+    uint8_t count;
+    while ((count = lnReadTrace(&lnBridgePort, records, LN_TRACE_SIZE)) != 0)
+    {
+        fwrite(records, sizeof(lnTraceRecord_t), count, lnBridgeTrace);
+    }
+}
+
+static int lnBridgeOpenTrace(const char* path)
+{
+    uint8_t header[LN_TRACE_FILE_HEADER];
+    lnBridgeTrace = fopen(path, "wb");
+    if (lnBridgeTrace == NULL)
+    {
+        return -1;
+    }
+    lnTraceFileHeader(header);
+    fwrite(header, 1, sizeof(header), lnBridgeTrace);
+    return 0;
+}
+
+static int lnBridgeListen(uint16_t port)
+{
+    struct sockaddr_in address = { .sin_family = AF_INET,
+            .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_ANY) };
+    int on = 1;
+    lnBridgeListener = socket(AF_INET, SOCK_STREAM, 0);
+    if (lnBridgeListener < 0 ||
+            setsockopt(lnBridgeListener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+            bind(lnBridgeListener, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+            listen(lnBridgeListener, 16) < 0 ||
+            lnBridgeSetNonBlocking(lnBridgeListener) < 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="main">
+
+static void lnBridgeUsage(void)
+{
+    fprintf(stderr,
+            "usage: lnbridge [-d device | -P] [-p port] [-T trace]\n"
+            "  -d  serial device with the LocoNet interface (16.66 kbaud)\n"
+            "  -P  loopback bus on a pty pair (no interface hardware)\n"
+            "  -p  TCP port of the LbServer protocol (default %u)\n"
+            "  -T  write the received bytes to a trace file\n",
+            LN_BRIDGE_PORT);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+    const char* device = NULL;
+    bool loopback = false;
+    unsigned long tcpPort = LN_BRIDGE_PORT;
+    const char* trace = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:Pp:T:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd': device = optarg; break;
+            case 'P': loopback = true; break;
+            case 'p': tcpPort = strtoul(optarg, NULL, 0); break;
+            case 'T': trace = optarg; break;
+            default: lnBridgeUsage();
+        }
+    }
+    if ((device == NULL) == !loopback || tcpPort == 0 || tcpPort > 0xffff)
+    {
+        lnBridgeUsage();
+    }
+    if (loopback ? lnBridgeOpenLoopback() < 0 : lnLinuxOpen(&lnBridgeSerial, device) < 0)
+    {
+        perror("lnbridge: serial device");
+        return EXIT_FAILURE;
+    }
+    if (lnBridgeListen((uint16_t)tcpPort) < 0)
+    {
+        perror("lnbridge: TCP port");
+        return EXIT_FAILURE;
+    }
+    if (trace != NULL && lnBridgeOpenTrace(trace) < 0)
+    {
+        perror("lnbridge: trace file");
+        return EXIT_FAILURE;
+    }
+    for (unsigned i = 0; i < LN_BRIDGE_MAX_CLIENTS; i++)
+    {
+        lnBridgeClients[i].fd = -1;
+    }
+    signal(SIGINT, lnBridgeSignal);
+    signal(SIGTERM, lnBridgeSignal);
+
+    lnInit(&lnBridgePort);
+    lnBridgePort.lastRandomValue = (uint16_t)(lnLinuxNow() | 1u);
+
+    struct pollfd fds[3 + LN_BRIDGE_MAX_CLIENTS];
+    lnBridgeClient_t* polled[LN_BRIDGE_MAX_CLIENTS];
+    while (!lnBridgeStop)
+    {
+        nfds_t n = 0;
+        fds[n++] = (struct pollfd){ .fd = lnBridgeSerial.fd, .events = POLLIN };
+        fds[n++] = (struct pollfd){ .fd = lnBridgeListener, .events = POLLIN };
+        fds[n++] = (struct pollfd){ .fd = lnBridgeLoopback, .events = POLLIN };
+        for (unsigned i = 0; i < LN_BRIDGE_MAX_CLIENTS; i++)
+        {
+            lnBridgeClient_t* client = &lnBridgeClients[i];
+            // throttle the input of a client that does not read or that
+            // waits for room in the LN TX queue
+            bool input = !client->blocked &&
+                    client->replyLength <= LN_BRIDGE_REPLY_SIZE / 2;
+            if (client->fd >= 0 && (input || lnBridgeHasOutput(client)))
+            {
+                short events = input ? POLLIN : 0;
+                events |= lnBridgeHasOutput(client) ? POLLOUT : 0;
+                polled[n - 3] = client;
+                fds[n++] = (struct pollfd){ .fd = client->fd, .events = events };
+            }
+        }
+        int64_t timeout = lnLinuxGetTimeout(&lnBridgePort);
+        struct timespec ts = { .tv_sec = timeout / 1000000, .tv_nsec = (timeout % 1000000) * 1000 };
+        if (ppoll(fds, n, (timeout < 0) ? NULL : &ts, NULL) < 0 && errno != EINTR)
+        {
+            perror("lnbridge: poll");
+            break;
+        }
+
+        // the driver: received bytes and timer 1
+        if (fds[0].revents & POLLIN)
+        {
+            lnLinuxRead(&lnBridgePort);
+        }
+        if (fds[2].revents & POLLIN)
+        {
+            lnBridgeEcho();
+        }
+        lnLinuxRunTimer(&lnBridgePort);
+        if (lnBridgeTrace != NULL)
+        {
+            lnBridgeWriteTrace();
+        }
+
+        // the clients: all SEND lines of this round go on the LN TX queue
+        if (fds[1].revents & POLLIN)
+        {
+            lnBridgeAccept();
+        }
+        for (nfds_t i = 3; i < n; i++)
+        {
+            if ((fds[i].events & POLLIN) && (fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                lnBridgeRead(polled[i - 3]);
+            }
+        }
+        if (lnBridgeUpdateBus())
+        {
+            for (unsigned i = 0; i < LN_BRIDGE_MAX_CLIENTS; i++)
+            {
+                if (lnBridgeClients[i].fd >= 0 && lnBridgeClients[i].blocked)
+                {
+                    lnBridgeParse(&lnBridgeClients[i]);
+                }
+            }
+        }
+        for (unsigned i = 0; i < LN_BRIDGE_MAX_CLIENTS; i++)
+        {
+            if (lnBridgeClients[i].fd >= 0 && lnBridgeHasOutput(&lnBridgeClients[i]))
+            {
+                lnBridgeWrite(&lnBridgeClients[i]);
+            }
+        }
+    }
+
+    if (lnBridgeTrace != NULL)
+    {
+        if (lnBridgePort.trace.lost != 0)
+        {
+            fprintf(stderr, "lnbridge: %u trace records lost\n", lnBridgePort.trace.lost);
+        }
+        fclose(lnBridgeTrace);
+    }
+    lnStats_t stats;
+    lnGetStats(&lnBridgePort, &stats, false);
+    fprintf(stderr, "lnbridge: %u tx, %u rx, %u linebreaks, %u collisions, "
+            "%u/%u dropped (rx/tx)\n", stats.txMessages, stats.rxMessages,
+            stats.linebreaks, stats.collisions, stats.rxDropped, stats.txDropped);
+    return EXIT_SUCCESS;
+}
+
+// </editor-fold>
@@ -0,0 +1,865 @@
+/*
+ * file: lndecode.c
+ * author: Geert Giebens, Jan van Hooydonk
+ * comments: LocoNet driver - offline decoder of captures
+ *
+ * decodes trace files (see ln_trace.h) and raw byte captures (every byte of
+ * the file is a received byte) and prints statistics per opcode and per
+ * address (switches, sensors, slots, locomotives).
+ *
+ * the framing is the one of the RX parser of the driver (rxHandler): a byte
+ * with msb = 1 starts a LN message, its length is LN_OPCODE_LENGTH or the
+ * second byte, a new opcode truncates the LN message in reception, a
+ * receiver overrun discards it, data bytes outside of a LN message are
+ * counted as stray bytes and framing errors are counted only.
+ *
+ * the files are mapped in memory and split in one chunk per worker thread.
+ * The opcodes are found 64 bytes at a time (SSE2, msb of every byte) and the
+ * checksums of the LN messages are validated in batches (SSE2, 4 LN messages
+ * of up to 8 bytes at a time, 16 bytes at a time for longer ones). A worker
+ * decodes the LN messages that start in its chunk, it reads up to
+ * LN_DECODE_OVERLAP records before and after the chunk to frame the LN
+ * messages across the boundaries like a single pass would.
+ *
+ * usage: lndecode [-r] [-j workers] [-a addresses] file ...
+ *
+ * revision history:
+ *  v1.0 Creation (16/10/2026)
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "../ln.h"
+#include "ln_trace.h"
+
+#define LN_DECODE_MAX_WORKERS 256u
+#define LN_DECODE_OVERLAP 256u          // records (a LN message is at most 127
+                                        // bytes)
+#define LN_DECODE_BATCH 256u            // LN messages per checksum batch
+#define LN_DECODE_PAD 16u               // bytes readable after a buffer
+
+// <editor-fold defaultstate="collapsed" desc="types">
+
+typedef struct lnDecodeStats_t
+{
+    uint64_t bytes;                     // data bytes
+    uint64_t messages;                  // LN messages with a correct checksum
+    uint64_t checksumErrors;
+    uint64_t truncatedMessages;         // ended by the next opcode or the end
+                                        // of the capture
+    uint64_t badLengths;                // variable length below 3
+    uint64_t strayBytes;                // data bytes outside of a LN message
+    uint64_t discarded;                 // LN messages discarded by an overrun
+    uint64_t framingErrors;             // trace: linebreaks
+    uint64_t overruns;                  // trace: receiver overruns
+    uint64_t opcodes[128][3];           // LN messages, checksum errors, bytes
+    uint64_t switches[2048];
+    uint64_t sensors[4096];
+    uint64_t slots[128];
+    uint64_t locos[16384];
+} lnDecodeStats_t;
+
+// a LN message of which the checksum has to be validated
+typedef struct lnDecodeCandidate_t
+{
+    size_t position;
+    uint8_t length;
+} lnDecodeCandidate_t;
+
+// a capture file in memory
+typedef struct lnDecodeFile_t
+{
+    const uint8_t* data;                // the records (trace) or the bytes
+    size_t records;
+    size_t recordSize;                  // LN_TRACE_RECORD or 1 (raw)
+} lnDecodeFile_t;
+
+typedef struct lnDecodeWorker_t
+{
+    pthread_t thread;
+    const lnDecodeFile_t* file;
+    size_t first;                       // the records of the chunk
+    size_t last;
+    lnDecodeStats_t* stats;
+} lnDecodeWorker_t;
+
+// the bytes of a chunk (with the overlap) and where its own part is
+typedef struct lnDecodeBuffer_t
+{
+    const uint8_t* bytes;
+    size_t size;
+    size_t begin;                       // first byte of the chunk
+    size_t end;                         // first byte after the chunk
+    size_t* breaks;                     // receiver overruns: the bytes before
+    size_t breakCount;                  // the position are discarded
+    // opcode scan: a window of 64 bytes
+    size_t scanBase;
+    uint64_t scanMask;
+} lnDecodeBuffer_t;
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="names">
+
+static const char* lnDecodeName(uint8_t opcode)
+{
+    switch (opcode)
+    {
+        case 0x81: return "OPC_BUSY";
+        case 0x82: return "OPC_GPOFF";
+        case 0x83: return "OPC_GPON";
+        case 0x85: return "OPC_IDLE";
+        case 0xa0: return "OPC_LOCO_SPD";
+        case 0xa1: return "OPC_LOCO_DIRF";
+        case 0xa2: return "OPC_LOCO_SND";
+        case 0xb0: return "OPC_SW_REQ";
+        case 0xb1: return "OPC_SW_REP";
+        case 0xb2: return "OPC_INPUT_REP";
+        case 0xb4: return "OPC_LONG_ACK";
+        case 0xb5: return "OPC_SLOT_STAT1";
+        case 0xb6: return "OPC_CONSIST_FUNC";
+        case 0xb8: return "OPC_UNLINK_SLOTS";
+        case 0xb9: return "OPC_LINK_SLOTS";
+        case 0xba: return "OPC_MOVE_SLOTS";
+        case 0xbb: return "OPC_RQ_SL_DATA";
+        case 0xbc: return "OPC_SW_STATE";
+        case 0xbd: return "OPC_SW_ACK";
+        case 0xbf: return "OPC_LOCO_ADR";
+        case 0xe5: return "OPC_PEER_XFER";
+        case 0xe7: return "OPC_SL_RD_DATA";
+        case 0xed: return "OPC_IMM_PACKET";
+        case 0xef: return "OPC_WR_SL_DATA";
+        default: return "";
+    }
+}
+
+/**
+ * count the address of a valid LN message (same decoding as getLnAddress of
+ * the driver)
+ * @param stats: the statistics
+ * @param message: the LN message (at least 4 bytes if it has an address)
+ */
+static void lnDecodeAddress(lnDecodeStats_t* stats, const uint8_t* message)
+{
+    switch (message[0])
+    {
+        case 0xb0:
+        case 0xb1:
+        case 0xbc:
+        case 0xbd:
+            stats->switches[((message[2] & 0x0f) << 7) | message[1]]++;
+            break;
+        case 0xb2:
+            stats->sensors[((((message[2] & 0x0f) << 7) | message[1]) << 1) |
+                    ((message[2] >> 5) & 1u)]++;
+            break;
+        case 0xa0:
+        case 0xa1:
+        case 0xa2:
+        case 0xb5:
+        case 0xbb:
+            stats->slots[message[1]]++;
+            break;
+        case 0xe7:
+        case 0xef:
+            stats->slots[message[2]]++;
+            break;
+        case 0xbf:
+            stats->locos[(message[1] << 7) | message[2]]++;
+            break;
+        default:
+            break;
+    }
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="vector routines">
+
+/**
+ * get the opcodes (msb = 1) of 64 bytes
+ * @param bytes: the bytes (64 readable bytes)
+ * @return bit i is set if byte i is an opcode
+ */
+static inline uint64_t lnDecodeOpcodes64(const uint8_t* bytes)
+{
+#if defined(__SSE2__)
+    uint64_t m0 = (uint16_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)bytes));
+    uint64_t m1 = (uint16_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(bytes + 16)));
+    uint64_t m2 = (uint16_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(bytes + 32)));
+    uint64_t m3 = (uint16_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(bytes + 48)));
+    return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+#else
+    uint64_t mask = 0;
+    for (unsigned i = 0; i < 64; i++)
+    {
+        mask |= (uint64_t)(bytes[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+/**
+ * find the next opcode
+ * @param buffer: the bytes
+ * @param from: the first byte to test
+ * @return the position of the opcode, buffer->size: if there is none
+ */
+static size_t lnDecodeNextOpcode(lnDecodeBuffer_t* buffer, size_t from)
+{
+    size_t base = from & ~(size_t)63;
+    if (base != buffer->scanBase)
+    {
+        buffer->scanBase = base;
+        buffer->scanMask = lnDecodeOpcodes64(buffer->bytes + base);
+    }
+    uint64_t mask = buffer->scanMask & (~(uint64_t)0 << (from & 63));
+    while (mask == 0)
+    {
+        base += 64;
+        if (base >= buffer->size)
+        {
+            return buffer->size;
+        }
+        buffer->scanBase = base;
+        buffer->scanMask = mask = lnDecodeOpcodes64(buffer->bytes + base);
+    }
+    size_t position = base + (size_t)__builtin_ctzll(mask);
+    return (position < buffer->size) ? position : buffer->size;
+}
+
+/**
+ * XOR of the bytes of a LN message of up to 8 bytes (the 8 bytes at the
+ * position must be readable)
+ */
+static inline uint64_t lnDecodeLoad8(const uint8_t* bytes, uint8_t length)
+{
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return (length < 8) ? value & ((UINT64_C(1) << (8 * length)) - 1) : value;
+}
+
+/**
+ * validate the checksums of a batch of LN messages (the XOR of all bytes is
+ * 0xff)
+ * @param bytes: the bytes (LN_DECODE_PAD readable bytes after the last
+ * LN message)
+ * @param candidates: the LN messages
+ * @param count: the number of LN messages
+ * @param valid: the result per LN message
+ */
+static void lnDecodeChecksums(const uint8_t* bytes, const lnDecodeCandidate_t* candidates,
+        size_t count, bool* valid)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    // 4 short LN messages at a time, one in every 64 bit lane
+    for (; i + 4 <= count; i += 4)
+    {
+        const lnDecodeCandidate_t* c = &candidates[i];
+        if ((c[0].length | c[1].length | c[2].length | c[3].length) > 8)
+        {
+            break;
+        }
+        __m128i a = _mm_set_epi64x((long long)lnDecodeLoad8(bytes + c[1].position, c[1].length),
+                (long long)lnDecodeLoad8(bytes + c[0].position, c[0].length));
+        __m128i b = _mm_set_epi64x((long long)lnDecodeLoad8(bytes + c[3].position, c[3].length),
+                (long long)lnDecodeLoad8(bytes + c[2].position, c[2].length));
+        a = _mm_xor_si128(a, _mm_srli_epi64(a, 32));
+        b = _mm_xor_si128(b, _mm_srli_epi64(b, 32));
+        a = _mm_xor_si128(a, _mm_srli_epi64(a, 16));
+        b = _mm_xor_si128(b, _mm_srli_epi64(b, 16));
+        a = _mm_xor_si128(a, _mm_srli_epi64(a, 8));
+        b = _mm_xor_si128(b, _mm_srli_epi64(b, 8));
+        valid[i] = (_mm_extract_epi16(a, 0) & 0xff) == 0xff;
+        valid[i + 1] = (_mm_extract_epi16(a, 4) & 0xff) == 0xff;
+        valid[i + 2] = (_mm_extract_epi16(b, 0) & 0xff) == 0xff;
+        valid[i + 3] = (_mm_extract_epi16(b, 4) & 0xff) == 0xff;
+    }
+#endif
+    for (; i < count; i++)
+    {
+        const uint8_t* message = bytes + candidates[i].position;
+        uint8_t length = candidates[i].length;
+        uint8_t checksum;
+        if (length <= 8)
+        {
+            uint64_t value = lnDecodeLoad8(message, length);
+            value ^= value >> 32;
+            value ^= value >> 16;
+            value ^= value >> 8;
+            checksum = (uint8_t)value;
+        }
+        else
+        {
+#if defined(__SSE2__)
+            // 16 bytes at a time, the bytes after the LN message are masked
+            static const uint8_t tail[32] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+            __m128i sum = _mm_setzero_si128();
+            uint8_t j = 0;
+            for (; j + 16 <= length; j += 16)
+            {
+                sum = _mm_xor_si128(sum, _mm_loadu_si128((const __m128i*)(message + j)));
+            }
+            __m128i rest = _mm_loadu_si128((const __m128i*)(message + j));
+            __m128i mask = _mm_loadu_si128((const __m128i*)(tail + 16 - (length - j)));
+            sum = _mm_xor_si128(sum, _mm_and_si128(rest, mask));
+            sum = _mm_xor_si128(sum, _mm_srli_si128(sum, 8));
+            uint64_t value = (uint64_t)_mm_cvtsi128_si64(sum);
+            value ^= value >> 32;
+            value ^= value >> 16;
+            value ^= value >> 8;
+            checksum = (uint8_t)value;
+#else
+            checksum = 0;
+            for (uint8_t j = 0; j < length; j++)
+            {
+                checksum ^= message[j];
+            }
+#endif
+        }
+        valid[i] = (checksum == 0xff);
+    }
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="decoding">
+
+/**
+ * count the LN messages of a batch
+ */
+static void lnDecodeFlush(lnDecodeStats_t* stats, const uint8_t* bytes,
+        const lnDecodeCandidate_t* candidates, size_t count)
+{
+    bool valid[LN_DECODE_BATCH];
+    lnDecodeChecksums(bytes, candidates, count, valid);
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8_t* message = bytes + candidates[i].position;
+        uint64_t* opcode = stats->opcodes[message[0] & 0x7f];
+        opcode[2] += candidates[i].length;
+        if (valid[i])
+        {
+            opcode[0]++;
+            stats->messages++;
+            if (candidates[i].length >= 4)
+            {
+                lnDecodeAddress(stats, message);
+            }
+        }
+        else
+        {
+            opcode[1]++;
+            stats->checksumErrors++;
+        }
+    }
+}
+
+/**
+ * count the data bytes in a range that belong to the chunk
+ */
+static inline uint64_t lnDecodeOwn(const lnDecodeBuffer_t* buffer, size_t from, size_t to)
+{
+    if (from < buffer->begin) from = buffer->begin;
+    if (to > buffer->end) to = buffer->end;
+    return (to > from) ? to - from : 0;
+}
+
+/**
+ * frame the LN messages of a buffer (like rxHandler) and count the ones that
+ * start in the chunk
+ * @param buffer: the bytes of the chunk with the overlap
+ * @param atEnd: the buffer ends at the end of the capture
+ * @param stats: the statistics of the worker
+ */
+static void lnDecodeFrame(lnDecodeBuffer_t* buffer, bool atEnd, lnDecodeStats_t* stats)
+{
+    lnDecodeCandidate_t candidates[LN_DECODE_BATCH];
+    size_t count = 0;
+    size_t nextBreak = 0;
+
+    buffer->scanBase = SIZE_MAX;
+    size_t position = lnDecodeNextOpcode(buffer, 0);
+    if (buffer->begin == 0)
+    {
+        // the start of the capture
+        stats->strayBytes += lnDecodeOwn(buffer, 0, position);
+    }
+    while (position < buffer->end)
+    {
+        size_t next = lnDecodeNextOpcode(buffer, position + 1);
+        while (nextBreak < buffer->breakCount && buffer->breaks[nextBreak] <= position)
+        {
+            nextBreak++;
+        }
+        size_t limit = next;
+        bool broken = false;
+        if (nextBreak < buffer->breakCount && buffer->breaks[nextBreak] < limit)
+        {
+            limit = buffer->breaks[nextBreak];
+            broken = true;
+        }
+        bool own = (position >= buffer->begin);
+        size_t length = LN_OPCODE_LENGTH(buffer->bytes[position]);
+        bool variable = (length == 0);
+        size_t used;
+        if (variable && position + 1 < limit)
+        {
+            length = buffer->bytes[position + 1];
+        }
+        if (variable && position + 1 < limit && length < LN_VARIABLE_MIN_LENGTH)
+        {
+            // the rest up to the next opcode is stray
+            used = 2;
+            stats->badLengths += own;
+        }
+        else if (length != 0 && position + length <= limit)
+        {
+            used = length;
+            if (own)
+            {
+                candidates[count].position = position;
+                candidates[count].length = (uint8_t)length;
+                if (++count == LN_DECODE_BATCH)
+                {
+                    lnDecodeFlush(stats, buffer->bytes, candidates, count);
+                    count = 0;
+                }
+            }
+        }
+        else
+        {
+            used = limit - position;
+            if (own)
+            {
+                if (broken)
+                {
+                    stats->discarded++;
+                }
+                else if (next < buffer->size || atEnd)
+                {
+                    stats->truncatedMessages++;
+                }
+            }
+        }
+        stats->strayBytes += lnDecodeOwn(buffer, position + used, next);
+        position = next;
+    }
+    lnDecodeFlush(stats, buffer->bytes, candidates, count);
+}
+
+/**
+ * copy the data bytes of trace records in a buffer (16 records at a time if
+ * they are all data records) and collect the receiver overruns
+ * @param records: the trace records
+ * @param count: the number of records
+ * @param bytes: the buffer (count + 64 + LN_DECODE_PAD bytes)
+ * @param breaks: the positions of the overruns (count entries)
+ * @param first: the first record of the chunk
+ * @param last: the first record after the chunk
+ * @param buffer: the resulting buffer
+ * @param stats: the statistics of the worker
+ */
+static void lnDecodeCompact(const uint8_t* records, size_t count, uint8_t* bytes,
+        size_t* breaks, size_t first, size_t last, lnDecodeBuffer_t* buffer,
+        lnDecodeStats_t* stats)
+{
+    size_t size = 0;
+    size_t breakCount = 0;
+    size_t i = 0;
+
+    buffer->begin = SIZE_MAX;
+    while (i < count)
+    {
+        if (i == first)
+        {
+            buffer->begin = size;
+        }
+        if (i == last)
+        {
+            buffer->end = size;
+        }
+#if defined(__SSE2__)
+        // events (byte 2) and values (byte 3) of 16 records
+        bool boundary = (first > i && first < i + 16) || (last > i && last < i + 16);
+        if (i + 16 <= count && !boundary)
+        {
+            const __m128i* block = (const __m128i*)(records + i * LN_TRACE_RECORD);
+            __m128i r0 = _mm_loadu_si128(block);
+            __m128i r1 = _mm_loadu_si128(block + 1);
+            __m128i r2 = _mm_loadu_si128(block + 2);
+            __m128i r3 = _mm_loadu_si128(block + 3);
+            __m128i events = _mm_packus_epi16(
+                    _mm_packs_epi32(_mm_srli_epi32(_mm_slli_epi32(r0, 8), 24),
+                    _mm_srli_epi32(_mm_slli_epi32(r1, 8), 24)),
+                    _mm_packs_epi32(_mm_srli_epi32(_mm_slli_epi32(r2, 8), 24),
+                    _mm_srli_epi32(_mm_slli_epi32(r3, 8), 24)));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(events, _mm_setzero_si128())) == 0xffff)
+            {
+                __m128i values = _mm_packus_epi16(
+                        _mm_packs_epi32(_mm_srli_epi32(r0, 24), _mm_srli_epi32(r1, 24)),
+                        _mm_packs_epi32(_mm_srli_epi32(r2, 24), _mm_srli_epi32(r3, 24)));
+                _mm_storeu_si128((__m128i*)(bytes + size), values);
+                size += 16;
+                if (i >= first && i < last)
+                {
+                    stats->bytes += 16;
+                }
+                i += 16;
+                continue;
+            }
+        }
+#endif
+        const uint8_t* record = records + i * LN_TRACE_RECORD;
+        bool own = (i >= first && i < last);
+        switch (record[2])
+        {
+            case LN_TRACE_DATA:
+                bytes[size++] = record[3];
+                stats->bytes += own;
+                break;
+            case LN_TRACE_FERR:
+                stats->framingErrors += own;
+                break;
+            case LN_TRACE_OERR:
+                breaks[breakCount++] = size;
+                stats->overruns += own;
+                break;
+            default:
+                break;
+        }
+        i++;
+    }
+    if (buffer->begin == SIZE_MAX)
+    {
+        buffer->begin = size;
+    }
+    if (last >= count)
+    {
+        buffer->end = size;
+    }
+    memset(bytes + size, 0, 64 + LN_DECODE_PAD);
+    buffer->bytes = bytes;
+    buffer->size = size;
+    buffer->breaks = breaks;
+    buffer->breakCount = breakCount;
+}
+
+static void* lnDecodeWorker(void* argument)
+{
+    lnDecodeWorker_t* worker = argument;
+    const lnDecodeFile_t* file = worker->file;
+    size_t first = (worker->first > LN_DECODE_OVERLAP) ? worker->first - LN_DECODE_OVERLAP : 0;
+    size_t last = worker->last + LN_DECODE_OVERLAP;
+    if (last > file->records)
+    {
+        last = file->records;
+    }
+    size_t count = last - first;
+    bool atEnd = (last == file->records);
+    lnDecodeBuffer_t buffer;
+
+    if (file->recordSize == 1)
+    {
+        // raw capture: decoded in place (the mapping is padded, see
+        // lnDecodeMap)
+        buffer.bytes = file->data + first;
+        buffer.size = count;
+        buffer.begin = worker->first - first;
+        buffer.end = worker->last - first;
+        buffer.breaks = NULL;
+        buffer.breakCount = 0;
+        worker->stats->bytes += worker->last - worker->first;
+        lnDecodeFrame(&buffer, atEnd, worker->stats);
+    }
+    else
+    {
+        uint8_t* bytes = malloc(count + 64 + LN_DECODE_PAD);
+        size_t* breaks = malloc((count + 1) * sizeof(size_t));
+        if (bytes == NULL || breaks == NULL)
+        {
+            fprintf(stderr, "lndecode: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        lnDecodeCompact(file->data + first * LN_TRACE_RECORD, count, bytes, breaks,
+                worker->first - first, worker->last - first, &buffer, worker->stats);
+        lnDecodeFrame(&buffer, atEnd, worker->stats);
+        free(bytes);
+        free(breaks);
+    }
+    return NULL;
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="files">
+
+/**
+ * map a capture file in memory, followed by at least one page of zeros (the
+ * vector routines read up to 64 bytes past a position)
+ * @param path: the file
+ * @param raw: the file is a raw byte capture (also without a trace header)
+ * @param file: the records of the file
+ * @param base: the mapping (to unmap)
+ * @param length: the length of the mapping
+ * @return true: if the file is mapped
+ */
+static bool lnDecodeMap(const char* path, bool raw, lnDecodeFile_t* file,
+        void** base, size_t* length)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) < 0)
+    {
+        perror(path);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return false;
+    }
+    size_t size = (size_t)status.st_size;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    *length = (size + 2 * page - 1) & ~(page - 1);
+    // the file is mapped over a mapping of zeros
+    uint8_t* data = mmap(NULL, *length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED ||
+            (size != 0 && mmap(data, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED))
+    {
+        perror(path);
+        close(fd);
+        return false;
+    }
+    close(fd);
+    madvise(data, size, MADV_SEQUENTIAL);
+    *base = data;
+
+    if (!raw && size >= LN_TRACE_FILE_HEADER && lnTraceFileCheck(data))
+    {
+        file->data = data + LN_TRACE_FILE_HEADER;
+        file->records = (size - LN_TRACE_FILE_HEADER) / LN_TRACE_RECORD;
+        file->recordSize = LN_TRACE_RECORD;
+    }
+    else
+    {
+        file->data = data;
+        file->records = size;
+        file->recordSize = 1;
+    }
+    return true;
+}
+
+/**
+ * decode a capture file with a number of workers
+ * @param file: the capture file
+ * @param workers: the maximum number of workers
+ * @param stats: the statistics (added to)
+ * @return the number of workers used
+ */
+static unsigned lnDecodeFile(const lnDecodeFile_t* file, unsigned workers, lnDecodeStats_t* stats)
+{
+    static lnDecodeWorker_t worker[LN_DECODE_MAX_WORKERS];
+
+    // chunks of at least 64k records
+    size_t chunks = file->records / 0x10000u;
+    if (chunks < workers)
+    {
+        workers = (chunks > 0) ? (unsigned)chunks : 1u;
+    }
+    for (unsigned i = 0; i < workers; i++)
+    {
+        worker[i].file = file;
+        worker[i].first = file->records * i / workers;
+        worker[i].last = file->records * (i + 1) / workers;
+        worker[i].stats = calloc(1, sizeof(lnDecodeStats_t));
+        if (worker[i].stats == NULL ||
+                pthread_create(&worker[i].thread, NULL, lnDecodeWorker, &worker[i]) != 0)
+        {
+            fprintf(stderr, "lndecode: can not start a worker\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (unsigned i = 0; i < workers; i++)
+    {
+        pthread_join(worker[i].thread, NULL);
+        // the statistics are counters only
+        uint64_t* total = (uint64_t*)stats;
+        const uint64_t* part = (const uint64_t*)worker[i].stats;
+        for (size_t j = 0; j < sizeof(lnDecodeStats_t) / sizeof(uint64_t); j++)
+        {
+            total[j] += part[j];
+        }
+        free(worker[i].stats);
+    }
+    return workers;
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="report">
+
+/**
+ * print the addresses with the most LN messages
+ * @param label: the kind of address
+ * @param counts: the LN messages per address
+ * @param size: the number of addresses
+ * @param offset: added to the address (switch and sensor numbers start at 1)
+ * @param top: the number of addresses to print
+ */
+static void lnDecodeTop(const char* label, const uint64_t* counts, size_t size,
+        unsigned offset, unsigned top)
+{
+    uint64_t limit = UINT64_MAX;
+    size_t limitIndex = 0;
+    bool any = false;
+
+    printf("%-15s:", label);
+    for (unsigned n = 0; n < top; n++)
+    {
+        // the next largest count (ties in address order)
+        size_t best = size;
+        for (size_t i = 0; i < size; i++)
+        {
+            if (counts[i] == 0 || counts[i] > limit || (counts[i] == limit && i <= limitIndex))
+            {
+                continue;
+            }
+            if (best == size || counts[i] > counts[best])
+            {
+                best = i;
+            }
+        }
+        if (best == size)
+        {
+            break;
+        }
+        printf(" %zu (%llu)", best + offset, (unsigned long long)counts[best]);
+        limit = counts[best];
+        limitIndex = best;
+        any = true;
+    }
+    printf("%s\n", any ? "" : " -");
+}
+
+static void lnDecodeReport(const lnDecodeStats_t* stats, unsigned top)
+{
+    printf("bytes          : %llu (%llu stray)\n", (unsigned long long)stats->bytes,
+            (unsigned long long)stats->strayBytes);
+    printf("messages       : %llu, %llu checksum errors, %llu truncated, %llu bad length, "
+            "%llu discarded (overrun)\n",
+            (unsigned long long)stats->messages, (unsigned long long)stats->checksumErrors,
+            (unsigned long long)stats->truncatedMessages, (unsigned long long)stats->badLengths,
+            (unsigned long long)stats->discarded);
+    printf("receiver       : %llu framing errors, %llu overruns\n",
+            (unsigned long long)stats->framingErrors, (unsigned long long)stats->overruns);
+
+    printf("\nopcode  name              messages  checksum       bytes\n");
+    for (unsigned i = 0; i < 128; i++)
+    {
+        const uint64_t* opcode = stats->opcodes[i];
+        if (opcode[0] != 0 || opcode[1] != 0)
+        {
+            printf("  0x%02x  %-16s %9llu %9llu %11llu\n", 0x80 | i, lnDecodeName(0x80 | i),
+                    (unsigned long long)opcode[0], (unsigned long long)opcode[1],
+                    (unsigned long long)opcode[2]);
+        }
+    }
+    if (top != 0)
+    {
+        printf("\n");
+        lnDecodeTop("switches", stats->switches, 2048, 1, top);
+        lnDecodeTop("sensors", stats->sensors, 4096, 1, top);
+        lnDecodeTop("slots", stats->slots, 128, 0, top);
+        lnDecodeTop("locomotives", stats->locos, 16384, 0, top);
+    }
+}
+
+// </editor-fold>
+
+static void lnDecodeUsage(void)
+{
+    fprintf(stderr,
+            "usage: lndecode [-r] [-j workers] [-a addresses] file ...\n"
+            "  -r  the files are raw byte captures (default: trace files are\n"
+            "      recognised by their header)\n"
+            "  -j  number of worker threads (default: number of cpus)\n"
+            "  -a  number of addresses per kind with the most LN messages\n"
+            "      (default 10, 0: none)\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+    bool raw = false;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned workers = (cpus > 0) ? (unsigned)cpus : 1u;
+    unsigned top = 10;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "rj:a:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r': raw = true; break;
+            case 'j': workers = (unsigned)atoi(optarg); break;
+            case 'a': top = (unsigned)atoi(optarg); break;
+            default: lnDecodeUsage();
+        }
+    }
+    if (optind >= argc || workers < 1)
+    {
+        lnDecodeUsage();
+    }
+    if (workers > LN_DECODE_MAX_WORKERS)
+    {
+        workers = LN_DECODE_MAX_WORKERS;
+    }
+
+    lnDecodeStats_t* stats = calloc(1, sizeof(lnDecodeStats_t));
+    if (stats == NULL)
+    {
+        fprintf(stderr, "lndecode: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t size = 0;
+    unsigned used = 1;
+    for (int i = optind; i < argc; i++)
+    {
+        lnDecodeFile_t file;
+        void* base;
+        size_t length;
+        if (!lnDecodeMap(argv[i], raw, &file, &base, &length))
+        {
+            return EXIT_FAILURE;
+        }
+        unsigned n = lnDecodeFile(&file, workers, stats);
+        used = (n > used) ? n : used;
+        printf("file           : %s, %s, %zu records\n", argv[i],
+                (file.recordSize == 1) ? "raw" : "trace", file.records);
+        size += file.records * file.recordSize;
+        munmap(base, length);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    lnDecodeReport(stats, top);
+    printf("\ntime           : %.3f s (%.1f MB/s, %u workers)\n", seconds,
+            (seconds > 0.0) ? size / seconds / 1e6 : 0.0, used);
+    free(stats);
+    return EXIT_SUCCESS;
+}
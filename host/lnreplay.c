@@ -0,0 +1,514 @@
+/*
+ * file: lnreplay.c
+ * author: Geert Giebens, Jan van Hooydonk
+ * comments: LocoNet driver - deterministic replay of a trace file
+ *
+ * feeds the records of a trace file (see ln_trace.h) into the (unmodified)
+ * LocoNet driver through the ISRs of the PIC18F4620 and the register file
+ * of xc.h, on a simulated clock: at full speed or in real time (-R). The
+ * application can offer LN messages (-q, -i), the transmitted bytes are
+ * echoed 600s later unless a byte of the trace arrives first.
+ *
+ * every LN message of the LN RX queue, every transmitted byte and every
+ * linebreak of the driver is added with its time to a digest (FNV-1a). The
+ * trace is replayed a number of times (-n) and the digests must be
+ * identical, the digest of a run can also be compared with the one of
+ * another build of the driver (eg. after a change of the RX parser).
+ *
+ * usage: lnreplay [-n runs] [-R] [-q messages] [-i interval] trace
+ *
+ * revision history:
+ *  v1.0 Creation (16/10/2026)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// the driver is compiled into this translation unit
+#include "../ln.c"
+#include "../ln_dispatch.c"
+#include "../ln_pic18f4620.c"
+#include "../circular_queue.c"
+#include "ln_trace.h"
+
+#define LN_REPLAY_BYTE_TIME 600u        // 10 bits of 60s
+#define LN_REPLAY_LINEBREAK 900u        // LN low during a linebreak
+#define LN_REPLAY_NEVER UINT64_MAX
+#define LN_REPLAY_FNV_OFFSET 0xcbf29ce484222325u
+#define LN_REPLAY_FNV_PRIME 0x100000001b3u
+
+// <editor-fold defaultstate="collapsed" desc="replay state">
+
+// the decoded trace
+static size_t lnReplayCount;
+static uint64_t* lnReplayTime;          // s since the start of the trace
+static uint8_t* lnReplayEvent;
+static uint8_t* lnReplayValue;
+
+lnSimRegs_t* lnSimRegs;
+
+static lnSimRegs_t lnReplayRegs;
+static lnPort_t lnReplayPort;
+static uint64_t lnReplayNow;
+static size_t lnReplayNext;             // next record of the trace
+static uint8_t lnReplayRcreg;
+static uint64_t lnReplayLowUntil;       // end of the last linebreak
+
+// timer 1 (1s per tick, overflow interrupt, can be stopped)
+static uint64_t lnReplayTmr1Expiry;
+static uint32_t lnReplayTmr1Remaining;
+static bool lnReplayTmr1On;
+// timer 3 (1s per tick, free running)
+static uint64_t lnReplayTmr3Expiry;
+
+// echo of the last transmitted byte
+static uint64_t lnReplayEchoTime;
+static uint8_t lnReplayEcho;
+
+// the application
+static unsigned lnReplayQueued;         // LN messages offered at the start
+static uint64_t lnReplayInterval;       // s between LN messages (0: none)
+static uint64_t lnReplayArrival;
+static uint16_t lnReplayAddress;
+
+// the result of a run
+typedef struct lnReplayResult_t
+{
+    uint64_t digest;
+    uint64_t rxMessages;
+    uint64_t txBytes;
+    uint64_t linebreaks;
+    uint64_t ignored;                   // trace bytes during a linebreak
+    double seconds;                     // wall time of the run
+} lnReplayResult_t;
+
+static lnReplayResult_t lnReplayResult;
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="register side effects">
+
+uint8_t lnSimReadRcreg(void)
+{
+    lnReplayRegs.pir1bits.RCIF = false;
+    lnReplayRegs.rcstabits.FERR = false;
+    return lnReplayRcreg;
+}
+
+void lnSimWriteTimer1(uint16_t value)
+{
+    lnReplayTmr1Remaining = 0x10000u - value;
+    if (lnReplayTmr1On)
+    {
+        lnReplayTmr1Expiry = lnReplayNow + lnReplayTmr1Remaining;
+    }
+}
+
+uint8_t* lnSimTimer3High(void)
+{
+    static uint8_t high;
+    high = (uint8_t)(lnReplayNow >> 8);
+    return &high;
+}
+
+/**
+ * follow the driver starting or stopping timer 1 (bit TMR1ON)
+ */
+static void lnReplaySyncTimer1(void)
+{
+    bool on = lnReplayRegs.t1conbits.TMR1ON;
+    if (on && !lnReplayTmr1On)
+    {
+        lnReplayTmr1Expiry = lnReplayNow + lnReplayTmr1Remaining;
+    }
+    else if (!on && lnReplayTmr1On)
+    {
+        lnReplayTmr1Remaining = (lnReplayTmr1Expiry > lnReplayNow) ?
+                (uint32_t)(lnReplayTmr1Expiry - lnReplayNow) : 0u;
+        lnReplayTmr1Expiry = LN_REPLAY_NEVER;
+    }
+    lnReplayTmr1On = on;
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="digest">
+
+static void lnReplayHash(const void* data, size_t length)
+{
+    const uint8_t* bytes = data;
+    for (size_t i = 0; i < length; i++)
+    {
+        lnReplayResult.digest = (lnReplayResult.digest ^ bytes[i]) * LN_REPLAY_FNV_PRIME;
+    }
+}
+
+/**
+ * add an output of the driver with its time to the digest
+ * @param kind: 'R' (LN message received), 'T' (byte transmitted) or 'B'
+ * (linebreak started)
+ * @param data: the bytes of the output
+ * @param length: the number of bytes
+ */
+static void lnReplayOutput(char kind, const uint8_t* data, uint8_t length)
+{
+    lnReplayHash(&kind, 1);
+    lnReplayHash(&lnReplayNow, sizeof(lnReplayNow));
+    lnReplayHash(&length, 1);
+    lnReplayHash(data, length);
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="driver execution">
+
+/**
+ * the line inputs of the driver (RC7 and RCIDL) from the records around
+ * the current time (a byte is in reception during the 600s before its
+ * record, LN is low during a linebreak)
+ */
+static void lnReplayUpdateInputs(void)
+{
+    bool busy = (lnReplayEchoTime != LN_REPLAY_NEVER);
+    bool low = (lnReplayNow < lnReplayLowUntil);
+    if (lnReplayNext < lnReplayCount &&
+            lnReplayTime[lnReplayNext] < lnReplayNow + LN_REPLAY_BYTE_TIME)
+    {
+        busy = true;
+        low = low || (lnReplayEvent[lnReplayNext] == LN_TRACE_FERR);
+    }
+    lnReplayRegs.portcbits.RC7 = !low;
+    lnReplayRegs.baudconbits.RCIDL = !busy;
+}
+
+/**
+ * run the ISRs as long as an interrupt flag is set (the high priority ISR
+ * first)
+ */
+static void lnReplayRunIsr(void)
+{
+    while ((lnReplayRegs.pie1bits.TMR1IE && lnReplayRegs.pir1bits.TMR1IF) ||
+            (lnReplayRegs.pie1bits.TMR2IE && lnReplayRegs.pir1bits.TMR2IF) ||
+            (lnReplayRegs.pie1bits.RCIE && lnReplayRegs.pir1bits.RCIF) ||
+            (lnReplayRegs.pie2bits.TMR3IE && lnReplayRegs.pir2bits.TMR3IF))
+    {
+        lnReplayUpdateInputs();
+        lnReplayRegs.txreg = LN_SIM_TXREG_EMPTY;
+        bool spen = lnReplayRegs.rcstabits.SPEN;
+        if (lnReplayRegs.pie1bits.RCIE && lnReplayRegs.pir1bits.RCIF &&
+                lnReplayRegs.ipr1bits.RCIP)
+        {
+            lnPic18f4620IsrHigh(&lnReplayPort);
+        }
+        else
+        {
+            lnPic18f4620IsrLow(&lnReplayPort);
+        }
+        lnReplaySyncTimer1();
+
+        if (lnReplayRegs.txreg != LN_SIM_TXREG_EMPTY)
+        {
+            uint8_t value = (uint8_t)lnReplayRegs.txreg;
+            lnReplayOutput('T', &value, 1);
+            lnReplayResult.txBytes++;
+            lnReplayEcho = value;
+            lnReplayEchoTime = lnReplayNow + LN_REPLAY_BYTE_TIME;
+        }
+        if (spen && !lnReplayRegs.rcstabits.SPEN)
+        {
+            // linebreak started: the EUSART is reset, the echo is lost
+            lnReplayOutput('B', NULL, 0);
+            lnReplayResult.linebreaks++;
+            lnReplayEchoTime = LN_REPLAY_NEVER;
+            lnReplayLowUntil = lnReplayNow + LN_REPLAY_LINEBREAK;
+        }
+
+        uint8_t message[127];
+        uint8_t length;
+        while ((length = lnReceiveMessage(&lnReplayPort, message, sizeof(message))) != 0)
+        {
+            lnReplayOutput('R', message, length);
+            lnReplayResult.rxMessages++;
+        }
+    }
+}
+
+/**
+ * hand a received byte or a receiver error to the EUSART
+ * @param event: LN_TRACE_DATA, LN_TRACE_FERR or LN_TRACE_OERR
+ * @param value: the received byte
+ */
+static void lnReplayReceive(uint8_t event, uint8_t value)
+{
+    if (!lnReplayRegs.rcstabits.SPEN)
+    {
+        // the EUSART is stopped during a linebreak of the driver
+        lnReplayResult.ignored++;
+        return;
+    }
+    if (event == LN_TRACE_OERR)
+    {
+        // the top half found the EUSART in overrun
+        pushRaw(&lnReplayPort, 0, LN_RAW_OERR);
+        lnReplayRegs.pir1bits.TMR2IF = true;
+    }
+    else
+    {
+        lnReplayRcreg = value;
+        lnReplayRegs.rcstabits.FERR = (event == LN_TRACE_FERR);
+        lnReplayRegs.pir1bits.RCIF = true;
+        if (event == LN_TRACE_FERR)
+        {
+            lnReplayLowUntil = lnReplayNow + LN_REPLAY_LINEBREAK - LN_REPLAY_BYTE_TIME;
+        }
+    }
+    lnReplayRunIsr();
+}
+
+/**
+ * offer a LN message (OPC_SW_REQ) to the driver
+ */
+static void lnReplayOffer(void)
+{
+    uint8_t message[4] = { 0xb0, (uint8_t)(lnReplayAddress & 0x7f),
+            (uint8_t)(0x30 | ((lnReplayAddress >> 7) & 0x0f)), 0 };
+    message[3] = 0xff ^ message[0] ^ message[1] ^ message[2];
+    lnReplayAddress = (lnReplayAddress + 1) & 0x7ff;
+    lnSendMessage(&lnReplayPort, message, sizeof(message));
+    lnReplaySyncTimer1();
+    lnReplayRunIsr();
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="replay">
+
+static uint64_t lnReplayWallClock(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+}
+
+static void lnReplaySleepUntil(uint64_t wall)
+{
+    struct timespec until = { .tv_sec = (time_t)(wall / 1000000u),
+            .tv_nsec = (long)(wall % 1000000u) * 1000 };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+}
+
+/**
+ * replay the trace once from a reset of the driver
+ * @param realTime: follow the times of the trace (instead of full speed)
+ */
+static void lnReplayRun(bool realTime)
+{
+    memset(&lnReplayRegs, 0, sizeof(lnReplayRegs));
+    memset(&lnReplayPort, 0, sizeof(lnReplayPort));
+    memset(&lnReplayResult, 0, sizeof(lnReplayResult));
+    lnReplayResult.digest = LN_REPLAY_FNV_OFFSET;
+    lnSimRegs = &lnReplayRegs;
+    lnReplayNow = 0;
+    lnReplayNext = 0;
+    lnReplayLowUntil = 0;
+    lnReplayTmr1On = false;
+    lnReplayTmr1Expiry = LN_REPLAY_NEVER;
+    lnReplayTmr1Remaining = 0;
+    lnReplayEchoTime = LN_REPLAY_NEVER;
+    lnReplayAddress = 0;
+    lnReplayArrival = (lnReplayInterval != 0) ? lnReplayInterval : LN_REPLAY_NEVER;
+    lnReplayRegs.portcbits.RC7 = true;
+    lnReplayRegs.baudconbits.RCIDL = true;
+
+    uint64_t start = lnReplayWallClock();
+    lnReplayPort.hal = &lnPic18f4620Hal;
+    lnInit(&lnReplayPort);
+    lnReplaySyncTimer1();
+    lnReplayTmr3Expiry = (lnReplayRegs.t3con & 1u) ? 0x10000u : LN_REPLAY_NEVER;
+    for (unsigned i = 0; i < lnReplayQueued; i++)
+    {
+        lnReplayOffer();
+    }
+
+    while (lnReplayNext < lnReplayCount)
+    {
+        uint64_t trace = lnReplayTime[lnReplayNext];
+        uint64_t next = trace;
+        if (lnReplayTmr1Expiry < next) next = lnReplayTmr1Expiry;
+        if (lnReplayTmr3Expiry < next) next = lnReplayTmr3Expiry;
+        if (lnReplayEchoTime < next) next = lnReplayEchoTime;
+        if (lnReplayArrival < next) next = lnReplayArrival;
+        if (realTime)
+        {
+            lnReplaySleepUntil(start + next);
+        }
+        lnReplayNow = next;
+
+        if (trace == next)
+        {
+            // a byte of the trace collides with the echo (if any)
+            lnReplayEchoTime = LN_REPLAY_NEVER;
+            lnReplayNext++;
+            lnReplayReceive(lnReplayEvent[lnReplayNext - 1], lnReplayValue[lnReplayNext - 1]);
+        }
+        else if (lnReplayEchoTime == next)
+        {
+            lnReplayEchoTime = LN_REPLAY_NEVER;
+            lnReplayReceive(LN_TRACE_DATA, lnReplayEcho);
+        }
+        else if (lnReplayTmr1Expiry == next)
+        {
+            lnReplayTmr1Expiry += 0x10000u;
+            lnReplayRegs.pir1bits.TMR1IF = true;
+            lnReplayRunIsr();
+        }
+        else if (lnReplayTmr3Expiry == next)
+        {
+            lnReplayTmr3Expiry += 0x10000u;
+            lnReplayRegs.pir2bits.TMR3IF = true;
+            lnReplayRunIsr();
+        }
+        else
+        {
+            lnReplayArrival += lnReplayInterval;
+            lnReplayOffer();
+        }
+    }
+    lnReplayResult.seconds = (double)(lnReplayWallClock() - start) / 1e6;
+}
+
+/**
+ * read and decode a trace file
+ * @param path: the trace file
+ * @return true: if the trace is loaded
+ */
+static bool lnReplayLoad(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror(path);
+        return false;
+    }
+    uint8_t header[LN_TRACE_FILE_HEADER];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) || !lnTraceFileCheck(header))
+    {
+        fprintf(stderr, "%s: not a trace file\n", path);
+        fclose(file);
+        return false;
+    }
+    size_t size = 4096;
+    lnReplayTime = malloc(size * sizeof(uint64_t));
+    lnReplayEvent = malloc(size);
+    lnReplayValue = malloc(size);
+    uint8_t record[LN_TRACE_RECORD];
+    uint64_t time = 0;
+    while (lnReplayTime != NULL && lnReplayEvent != NULL && lnReplayValue != NULL &&
+            fread(record, 1, sizeof(record), file) == sizeof(record))
+    {
+        time += lnTraceDelta(record);
+        if (record[2] == LN_TRACE_IDLE)
+        {
+            continue;
+        }
+        if (lnReplayCount == size)
+        {
+            size *= 2;
+            lnReplayTime = realloc(lnReplayTime, size * sizeof(uint64_t));
+            lnReplayEvent = realloc(lnReplayEvent, size);
+            lnReplayValue = realloc(lnReplayValue, size);
+            if (lnReplayTime == NULL || lnReplayEvent == NULL || lnReplayValue == NULL)
+            {
+                break;
+            }
+        }
+        // the driver is initialised at time 0, the trace starts 1ms later
+        lnReplayTime[lnReplayCount] = time + 1000u;
+        lnReplayEvent[lnReplayCount] = record[2];
+        lnReplayValue[lnReplayCount] = record[3];
+        lnReplayCount++;
+    }
+    fclose(file);
+    if (lnReplayTime == NULL || lnReplayEvent == NULL || lnReplayValue == NULL)
+    {
+        fprintf(stderr, "%s: out of memory\n", path);
+        return false;
+    }
+    return true;
+}
+
+static void lnReplayUsage(void)
+{
+    fprintf(stderr,
+            "usage: lnreplay [-n runs] [-R] [-q messages] [-i interval] trace\n"
+            "  -n  number of runs that must give the same digest (default 2)\n"
+            "  -R  replay in real time (default: full speed)\n"
+            "  -q  LN messages on the LN TX queue at the start (default 0)\n"
+            "  -i  offer a LN message every interval ms (default 0: none)\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned runs = 2;
+    bool realTime = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:Rq:i:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': runs = (unsigned)atoi(optarg); break;
+            case 'R': realTime = true; break;
+            case 'q': lnReplayQueued = (unsigned)atoi(optarg); break;
+            case 'i': lnReplayInterval = (uint64_t)(atof(optarg) * 1000.0); break;
+            default: lnReplayUsage();
+        }
+    }
+    if (optind != argc - 1 || runs < 1)
+    {
+        lnReplayUsage();
+    }
+    if (!lnReplayLoad(argv[optind]))
+    {
+        return EXIT_FAILURE;
+    }
+    printf("trace          : %zu records, %.3f s\n", lnReplayCount,
+            lnReplayCount ? (double)lnReplayTime[lnReplayCount - 1] / 1e6 : 0.0);
+
+    uint64_t digest = 0;
+    bool identical = true;
+    for (unsigned run = 1; run <= runs; run++)
+    {
+        lnReplayRun(realTime);
+        printf("run %-11u: digest %016llx, %llu rx messages, %llu tx bytes, "
+                "%llu linebreaks, %llu ignored, %.1f ms (%.2f M records/s)\n",
+                run, (unsigned long long)lnReplayResult.digest,
+                (unsigned long long)lnReplayResult.rxMessages,
+                (unsigned long long)lnReplayResult.txBytes,
+                (unsigned long long)lnReplayResult.linebreaks,
+                (unsigned long long)lnReplayResult.ignored,
+                lnReplayResult.seconds * 1e3,
+                lnReplayResult.seconds > 0.0 ? lnReplayCount / lnReplayResult.seconds / 1e6 : 0.0);
+        if (run == 1)
+        {
+            digest = lnReplayResult.digest;
+        }
+        identical = identical && (lnReplayResult.digest == digest);
+    }
+
+    lnStats_t stats;
+    lnGetStats(&lnReplayPort, &stats, false);
+    printf("driver         : %u tx, %u rx, %u linebreaks, %u collisions, "
+            "%u checksum, %u truncated, %u overrun bytes, %u bad length\n",
+            stats.txMessages, stats.rxMessages, stats.linebreaks, stats.collisions,
+            stats.checksumErrors, stats.truncatedMessages, stats.overrunBytes,
+            stats.badLengths);
+    printf("result         : %s\n", identical ? "identical" : "DIFFERENT");
+    return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// </editor-fold>
@@ -0,0 +1,1219 @@
+/*
+ * file: lnsim.c
+ * author: Geert Giebens, Jan van Hooydonk
+ * comments: LocoNet driver - multi-node bus simulator
+ *
+ * discrete-event simulator that runs N instances of the (unmodified) LocoNet
+ * driver on one shared wired-AND bus at 16.66 kbaud. Each node gets its own
+ * register file (see xc.h), its own EUSART receiver/transmitter model and its
+ * own timer 1 and its own LN port (lnPort_t) with the hardware hooks of the
+ * PIC18F4620, so the driver state of the nodes is never shared.
+ *
+ * usage: lnsim [-n nodes] [-l load | -r rate] [-L length] [-t seconds]
+ *              [-H share] [-W share] [-A addresses] [-s seed] [-u]
+ *              [-b attempts] [-d deadline] [-T threshold] [-G rate] [-B burst]
+ *              [-X bytes] [-w window]
+ *
+ * with -X node 0 sends a bulk transfer to node 1 (see ln_bulk.h), the
+ * simulation ends when the transfer is done
+ *
+ * revision history:
+ *  v1.0 Creation (16/10/2026)
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// the driver is compiled into this translation unit
+#include "../ln.c"
+#include "../ln_dispatch.c"
+#include "../ln_pic18f4620.c"
+#include "../circular_queue.c"
+#include "../ln_bulk.c"
+
+#define LN_SIM_BIT_TIME 60u             // 1 bit at 16.66 kbaud = 60s
+#define LN_SIM_BYTES_PER_SECOND (1000000.0 / (10 * LN_SIM_BIT_TIME))
+#define LN_SIM_MAX_NODES 512u
+#define LN_SIM_PENDING_SIZE 256u        // enqueue stamps per node
+#define LN_SIM_NEVER UINT64_MAX
+
+// <editor-fold defaultstate="collapsed" desc="types">
+
+typedef enum
+{
+    RX_IDLE,                            // waiting for a start bit
+    RX_WAIT_HIGH,                       // waiting for the line to go high
+    RX_BUSY                             // receiving a character
+} lnSimRxState_t;
+
+// enqueue stamps of the messages in a LN TX queue (FIFO)
+typedef struct lnSimPending_t
+{
+    uint64_t time[LN_SIM_PENDING_SIZE];
+    uint8_t length[LN_SIM_PENDING_SIZE];
+    uint16_t head;
+    uint16_t tail;
+} lnSimPending_t;
+
+typedef struct lnSimLatency_t
+{
+    uint32_t* values;
+    size_t count;
+    size_t size;
+} lnSimLatency_t;
+
+typedef struct lnSimNode_t
+{
+    lnSimRegs_t regs;
+    lnPort_t port;                      // the driver state of the node
+
+    // timer 1 (1s per tick, overflow interrupt, can be stopped)
+    uint64_t tmr1Expiry;
+    uint32_t tmr1Remaining;             // ticks to the overflow when stopped
+    bool tmr1On;
+
+    // timer 3 (1s per tick, free running, overflow interrupt)
+    uint64_t tmr3Start;
+    uint64_t tmr3Expiry;
+
+    // EUSART transmitter
+    bool txBusy;
+    bool txLevel;
+    uint8_t txBit;
+    uint16_t txShift;
+    uint16_t txPending;                 // TXREG while the TSR is busy
+    uint64_t txNextEdge;
+    bool drivesLow;                     // this node pulls the bus low
+
+    // EUSART receiver (2 byte FIFO)
+    lnSimRxState_t rxState;
+    uint8_t rxBit;
+    uint8_t rxShift;
+    uint64_t rxNextSample;
+    uint8_t rxFifo[2];
+    bool rxFifoFerr[2];
+    uint8_t rxFifoCount;
+
+    // application (load generator and consumer)
+    uint64_t nextArrival;
+    lnSimPending_t pending[LN_TX_PRIORITIES];
+} lnSimNode_t;
+
+typedef struct lnSimStats_t
+{
+    uint64_t offered;
+    uint64_t dropped;
+    uint64_t transmitted;
+    uint64_t transmittedBytes;
+    uint64_t received;
+    uint64_t collisions;
+    uint64_t linebreaks;
+    uint64_t framingErrors;
+    uint64_t overruns;
+    uint64_t tmr1Interrupts;
+    lnStats_t driver;                   // sum of the driver statistics
+    lnSimLatency_t latency[LN_TX_PRIORITIES];
+#if LN_LATENCY
+    lnLatency_t histogram;              // sum of the driver histograms
+#endif
+#if LN_TX_BUDGET
+    uint64_t completions[LN_TX_EVICTED + 1];    // per completion status
+    uint64_t statusLost;
+#endif
+#if LN_BUS_LOAD
+    unsigned busLoad;                   // sum of the estimates of the nodes
+#endif
+#if LN_BULK
+    uint64_t bulkWritten;               // bytes written by the bulk sink
+    uint64_t bulkErrors;                // bytes with a wrong value
+    uint64_t bulkEnd;                   // time the transfer is done
+#endif
+} lnSimStats_t;
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="simulator state">
+
+lnSimRegs_t* lnSimRegs;
+
+static lnSimNode_t lnSimNodes[LN_SIM_MAX_NODES];
+static lnSimNode_t* lnSimCurrent;
+static unsigned lnSimNumNodes = 8;
+static uint64_t lnSimNow;
+static bool lnSimBusLevel = true;       // idle LocoNet = high (mark)
+static uint64_t lnSimSeed = 1;
+static double lnSimRate;                // offered messages/s per node
+static unsigned lnSimLength = 4;
+static double lnSimHighShare;           // share of high priority messages
+static double lnSimLowShare;            // share of low priority messages
+static unsigned lnSimAddresses = 2048;  // switch addresses of OPC_SW_REQ
+#if LN_TX_BUDGET
+static unsigned lnSimAttempts;          // TX budget of every message
+static double lnSimDeadline;            // in ms (0: no deadline)
+#endif
+#if LN_BULK
+static uint32_t lnSimBulkSize;          // bulk transfer (0: none)
+static unsigned lnSimBulkWindow = LN_BULK_WINDOW;
+static lnBulkSender_t lnSimBulkSender;  // on node 0
+static lnBulkReceiver_t lnSimBulkReceiver;  // on node 1
+#endif
+#if LN_TX_LIMIT
+static unsigned lnSimThreshold;         // TX limiter of every node (0: off)
+static unsigned lnSimTokenRate = LN_TX_LIMIT_RATE;
+static unsigned lnSimBurst = LN_TX_LIMIT_BURST;
+#endif
+static lnSimStats_t lnSimStats;
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="helpers">
+
+/**
+ * xorshift random generator of the simulator (not the one of the driver)
+ * @return a 64 bit random value
+ */
+static uint64_t lnSimRandom(void)
+{
+    lnSimSeed ^= lnSimSeed << 13;
+    lnSimSeed ^= lnSimSeed >> 7;
+    lnSimSeed ^= lnSimSeed << 17;
+    return lnSimSeed;
+}
+
+static uint64_t lnSimNextArrival(void)
+{
+    if (lnSimRate <= 0.0)
+    {
+        return LN_SIM_NEVER;
+    }
+    double u = (double)((lnSimRandom() >> 11) + 1) / 9007199254740993.0;
+    return lnSimNow + 1 + (uint64_t)(-log(u) / lnSimRate * 1e6);
+}
+
+/**
+ * make the register file that of a node
+ * @param node: the node that is going to run driver code
+ */
+static void lnSimSelect(lnSimNode_t* node)
+{
+    lnSimCurrent = node;
+    lnSimRegs = &node->regs;
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="register side effects">
+
+uint8_t lnSimReadRcreg(void)
+{
+    lnSimNode_t* node = lnSimCurrent;
+    uint8_t value = node->rxFifo[0];
+    if (node->rxFifoCount > 0)
+    {
+        node->rxFifo[0] = node->rxFifo[1];
+        node->rxFifoFerr[0] = node->rxFifoFerr[1];
+        node->rxFifoCount--;
+    }
+    node->regs.rcstabits.FERR = (node->rxFifoCount > 0) && node->rxFifoFerr[0];
+    node->regs.pir1bits.RCIF = (node->rxFifoCount > 0);
+    return value;
+}
+
+void lnSimWriteTimer1(uint16_t value)
+{
+    // timer 1 overflows after (0x10000 - value) ticks of 1s
+    lnSimCurrent->tmr1Remaining = 0x10000u - value;
+    lnSimCurrent->tmr1Expiry = lnSimCurrent->regs.t1conbits.TMR1ON ?
+            lnSimNow + lnSimCurrent->tmr1Remaining : LN_SIM_NEVER;
+    lnSimCurrent->regs.tmr1h = (uint8_t)(value >> 8);
+    lnSimCurrent->regs.tmr1l = (uint8_t)value;
+}
+
+uint8_t* lnSimTimer3High(void)
+{
+    // bits 15 ... 8 of the ticks since the start of timer 3
+    lnSimNode_t* node = lnSimCurrent;
+    node->regs.tmr3h = (uint8_t)((lnSimNow - node->tmr3Start) >> 8);
+    return &node->regs.tmr3h;
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="EUSART and bus model">
+
+static void lnSimUpdateDriver(lnSimNode_t* node)
+{
+    if (node->regs.rcstabits.SPEN)
+    {
+        node->drivesLow = node->txBusy && !node->txLevel;
+    }
+    else
+    {
+        // serial port disabled: RC6 is a port pin (inverted line driver)
+        node->drivesLow = node->regs.portcbits.RC6;
+    }
+}
+
+static void lnSimStartTx(lnSimNode_t* node, uint8_t value)
+{
+    if (node->txBusy)
+    {
+        node->txPending = value;
+        return;
+    }
+    // start bit, 8 data bits (lsb first), stop bit
+    node->txShift = (uint16_t)((value << 1) | 0x200u);
+    node->txBit = 0;
+    node->txLevel = false;
+    node->txBusy = true;
+    node->txNextEdge = lnSimNow + LN_SIM_BIT_TIME;
+    lnSimUpdateDriver(node);
+}
+
+static void lnSimTxEdge(lnSimNode_t* node)
+{
+    node->txBit++;
+    if (node->txBit == 10)
+    {
+        node->txBusy = false;
+        node->txLevel = true;
+        lnSimUpdateDriver(node);
+        if (node->txPending != LN_SIM_TXREG_EMPTY)
+        {
+            uint8_t value = (uint8_t)node->txPending;
+            node->txPending = LN_SIM_TXREG_EMPTY;
+            lnSimStartTx(node, value);
+        }
+        return;
+    }
+    node->txLevel = (node->txShift >> node->txBit) & 1u;
+    node->txNextEdge = lnSimNow + LN_SIM_BIT_TIME;
+    lnSimUpdateDriver(node);
+}
+
+/**
+ * recalculate the wired-AND bus level and let the receivers react on edges
+ */
+static void lnSimUpdateBus(void)
+{
+    bool level = true;
+    for (unsigned i = 0; i < lnSimNumNodes; i++)
+    {
+        if (lnSimNodes[i].drivesLow)
+        {
+            level = false;
+        }
+    }
+    if (level == lnSimBusLevel)
+    {
+        return;
+    }
+    lnSimBusLevel = level;
+    for (unsigned i = 0; i < lnSimNumNodes; i++)
+    {
+        lnSimNode_t* node = &lnSimNodes[i];
+        if (!node->regs.rcstabits.SPEN || node->regs.rcstabits.OERR)
+        {
+            continue;
+        }
+        if (level && node->rxState == RX_WAIT_HIGH)
+        {
+            node->rxState = RX_IDLE;
+        }
+        else if (!level && node->rxState == RX_IDLE)
+        {
+            // start bit: sample in the middle of each bit
+            node->rxState = RX_BUSY;
+            node->rxBit = 0;
+            node->rxShift = 0;
+            node->rxNextSample = lnSimNow + LN_SIM_BIT_TIME / 2;
+        }
+    }
+}
+
+static void lnSimRxSample(lnSimNode_t* node)
+{
+    if (node->rxBit == 0)
+    {
+        if (lnSimBusLevel)
+        {
+            // false start bit
+            node->rxState = RX_IDLE;
+            return;
+        }
+    }
+    else if (node->rxBit <= 8)
+    {
+        node->rxShift |= (uint8_t)(lnSimBusLevel << (node->rxBit - 1));
+    }
+    else
+    {
+        // stop bit: a low level is a framing error (linebreak)
+        if (node->rxFifoCount == 2)
+        {
+            // the receiver stops until the driver toggles CREN, while the
+            // overrun is pending CREN reads 0 so the toggle can be detected
+            node->regs.rcstabits.OERR = true;
+            node->regs.rcstabits.CREN = false;
+            lnSimStats.overruns++;
+        }
+        else
+        {
+            node->rxFifo[node->rxFifoCount] = node->rxShift;
+            node->rxFifoFerr[node->rxFifoCount] = !lnSimBusLevel;
+            node->rxFifoCount++;
+        }
+        if (!lnSimBusLevel)
+        {
+            lnSimStats.framingErrors++;
+        }
+        node->regs.rcstabits.FERR = node->rxFifoFerr[0];
+        node->regs.pir1bits.RCIF = true;
+        node->rxState = lnSimBusLevel ? RX_IDLE : RX_WAIT_HIGH;
+        return;
+    }
+    node->rxBit++;
+    node->rxNextSample = lnSimNow + LN_SIM_BIT_TIME;
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="driver execution">
+
+static void lnSimRecordLatency(lnSimLatency_t* latency, uint32_t value)
+{
+    if (latency->count == latency->size)
+    {
+        latency->size = latency->size ? 2 * latency->size : 4096;
+        latency->values = realloc(latency->values, latency->size * sizeof(uint32_t));
+        if (latency->values == NULL)
+        {
+            perror("lnsim");
+            exit(EXIT_FAILURE);
+        }
+    }
+    latency->values[latency->count++] = value;
+}
+
+/**
+ * follow the driver starting or stopping timer 1 (bit TMR1ON)
+ * @param node: the node
+ */
+static void lnSimSyncTimer1(lnSimNode_t* node)
+{
+    bool on = node->regs.t1conbits.TMR1ON;
+    if (on == node->tmr1On)
+    {
+        return;
+    }
+    if (on)
+    {
+        node->tmr1Expiry = lnSimNow + node->tmr1Remaining;
+    }
+    else
+    {
+        node->tmr1Remaining = (uint32_t)(node->tmr1Expiry - lnSimNow);
+        node->tmr1Expiry = LN_SIM_NEVER;
+    }
+    node->tmr1On = on;
+}
+
+/**
+ * follow the LN TX queues of a node with the enqueue stamps: the messages
+ * out of TX budget are removed from the head of a LN TX queue, the messages
+ * of the bulk transfer are put on it outside of lnSimOffer
+ * @param node: the node
+ */
+static void lnSimSyncPending(lnSimNode_t* node)
+{
+    for (uint8_t priority = 0; priority < LN_TX_PRIORITIES; priority++)
+    {
+        lnSimPending_t* pending = &node->pending[priority];
+        volatile lnMessageQueue_t* queue = &node->port.txQueue[priority];
+        uint16_t queued = (queue->msgTail - queue->msgHead) & MESSAGE_QUEUE_MASK;
+        while ((uint16_t)(pending->tail - pending->head) > queued)
+        {
+            pending->head++;
+        }
+        while ((uint16_t)(pending->tail - pending->head) < queued)
+        {
+            uint8_t entry = (queue->msgTail - queued + (pending->tail - pending->head)) &
+                    MESSAGE_QUEUE_MASK;
+            uint16_t i = pending->tail++ % LN_SIM_PENDING_SIZE;
+            pending->time[i] = lnSimNow;
+            pending->length[i] = queue->lengths[entry];
+        }
+    }
+}
+
+/**
+ * run the ISRs of a node as long as an interrupt is pending (the high
+ * priority ISR first)
+ * @param node: the node
+ */
+static void lnSimRunIsr(lnSimNode_t* node)
+{
+    while ((node->regs.pie1bits.TMR1IE && node->regs.pir1bits.TMR1IF) ||
+            (node->regs.pie1bits.TMR2IE && node->regs.pir1bits.TMR2IF) ||
+            (node->regs.pie1bits.RCIE && node->regs.pir1bits.RCIF) ||
+            (node->regs.pie2bits.TMR3IE && node->regs.pir2bits.TMR3IF))
+    {
+        lnSimSelect(node);
+        node->regs.portcbits.RC7 = lnSimBusLevel;
+        node->regs.baudconbits.RCIDL = (node->rxState != RX_BUSY);
+        node->regs.txreg = LN_SIM_TXREG_EMPTY;
+
+        bool spen = node->regs.rcstabits.SPEN;
+        bool high = node->regs.pie1bits.RCIE && node->regs.pir1bits.RCIF &&
+                node->regs.ipr1bits.RCIP;
+        bool inFlight = node->port.LNCONbits.TX_MODE;
+        bool ferr = false;
+        volatile lnRawRing_t* ring = &node->port.rawRing;
+        for (uint8_t i = ring->head; i != ring->tail; i = (i + 1) & LN_RAW_MASK)
+        {
+            // a linebreak of another node is waiting for the bottom half
+            ferr = ferr || (ring->events[i] == LN_RAW_FERR);
+        }
+        if (!high && node->regs.pie1bits.TMR1IE && node->regs.pir1bits.TMR1IF)
+        {
+            lnSimStats.tmr1Interrupts++;
+        }
+
+        if (high)
+        {
+            lnPic18f4620IsrHigh(&node->port);
+        }
+        else
+        {
+            lnPic18f4620IsrLow(&node->port);
+        }
+        lnSimSyncTimer1(node);
+
+        if (node->regs.rcstabits.OERR && node->regs.rcstabits.CREN)
+        {
+            // receiver re-enabled after an overrun
+            node->regs.rcstabits.OERR = false;
+            node->rxState = lnSimBusLevel ? RX_IDLE : RX_WAIT_HIGH;
+        }
+        if (spen && !node->regs.rcstabits.SPEN)
+        {
+            // linebreak started: the EUSART is reset
+            node->txBusy = false;
+            node->txPending = LN_SIM_TXREG_EMPTY;
+            node->rxState = RX_WAIT_HIGH;
+            lnSimStats.linebreaks++;
+            if (!ferr)
+            {
+                lnSimStats.collisions++;
+            }
+        }
+        else if (!spen && node->regs.rcstabits.SPEN)
+        {
+            node->rxState = lnSimBusLevel ? RX_IDLE : RX_WAIT_HIGH;
+        }
+        if (node->regs.txreg != LN_SIM_TXREG_EMPTY)
+        {
+            lnSimStartTx(node, (uint8_t)node->regs.txreg);
+        }
+        lnSimUpdateDriver(node);
+        lnSimUpdateBus();
+
+        if (inFlight && !node->port.LNCONbits.TX_MODE && node->regs.rcstabits.SPEN)
+        {
+            // last byte of the message echoed correctly
+            uint8_t priority = node->port.LNCONbits.TX_PRIORITY;
+            lnSimPending_t* pending = &node->pending[priority];
+            uint16_t i = pending->head++ % LN_SIM_PENDING_SIZE;
+            lnSimRecordLatency(&lnSimStats.latency[priority],
+                    (uint32_t)(lnSimNow - pending->time[i]));
+            lnSimStats.transmitted++;
+            lnSimStats.transmittedBytes += pending->length[i];
+        }
+        lnSimSyncPending(node);
+    }
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="application">
+
+/**
+ * build a LN message with a valid checksum
+ * @param message: buffer for the message
+ * @param length: 2, 4, 6 or a variable length (7 ... 127)
+ */
+static void lnSimMakeMessage(uint8_t* message, uint8_t length)
+{
+    uint8_t checksum = 0xff;
+    switch (length)
+    {
+        case 2: message[0] = 0x81; break;   // OPC_BUSY
+        case 4: message[0] = 0xb0; break;   // OPC_SW_REQ
+        case 6: message[0] = 0xd0; break;
+        default: message[0] = 0xe5; break;  // OPC_PEER_XFER
+    }
+    for (uint8_t i = 1; i < length - 1; i++)
+    {
+        message[i] = (uint8_t)(lnSimRandom() & 0x7f);
+    }
+    if (length == 4)
+    {
+        // switch address (0 ... lnSimAddresses - 1), direction and output
+        unsigned address = (unsigned)(lnSimRandom() % lnSimAddresses);
+        message[1] = (uint8_t)(address & 0x7f);
+        message[2] = (uint8_t)((message[2] & 0x30) | (address >> 7));
+    }
+    if (length > 6)
+    {
+        message[1] = length;
+    }
+    for (uint8_t i = 0; i < length - 1; i++)
+    {
+        checksum ^= message[i];
+    }
+    message[length - 1] = checksum;
+}
+
+static void lnSimOffer(lnSimNode_t* node)
+{
+    uint8_t message[127];
+    uint8_t priority = LN_PRIORITY_NORMAL;
+    double u = (double)(lnSimRandom() >> 11) / 9007199254740992.0;
+    if (u < lnSimHighShare)
+    {
+        priority = LN_PRIORITY_HIGH;
+    }
+    else if (u < lnSimHighShare + lnSimLowShare)
+    {
+        priority = LN_PRIORITY_LOW;
+    }
+    lnSimPending_t* pending = &node->pending[priority];
+
+    lnSimSelect(node);
+    lnSimStats.offered++;
+    node->nextArrival = lnSimNextArrival();
+    lnSimMakeMessage(message, (uint8_t)lnSimLength);
+    uint16_t coalesced = node->port.stats.txCoalesced;
+    uint16_t evicted = node->port.stats.txEvicted;
+#if LN_TX_BUDGET
+    // the tag of a message is its priority + 1 (0: no completion status)
+    uint8_t tag = (lnSimAttempts != 0 || lnSimDeadline > 0.0) ? priority + 1 : 0;
+    if ((uint16_t)(pending->tail - pending->head) == LN_SIM_PENDING_SIZE ||
+            !lnSendBudgetMessage(&node->port, priority, message, (uint8_t)lnSimLength,
+            (uint8_t)lnSimAttempts, (uint16_t)(lnSimDeadline * 1000.0 / 256.0 + 0.5), tag))
+#else
+    if ((uint16_t)(pending->tail - pending->head) == LN_SIM_PENDING_SIZE ||
+            !lnSendPriorityMessage(&node->port, priority, message, (uint8_t)lnSimLength))
+#endif
+    {
+        lnSimStats.dropped++;
+        return;
+    }
+    for (; evicted != node->port.stats.txEvicted; evicted++)
+    {
+        // the oldest waiting message is removed from the LN TX queue
+        pending->head++;
+    }
+    lnSimSyncTimer1(node);
+    if (node->port.stats.txCoalesced != coalesced)
+    {
+        // a waiting message is replaced, nothing new to transmit
+        return;
+    }
+    uint16_t i = pending->tail++ % LN_SIM_PENDING_SIZE;
+    pending->time[i] = lnSimNow;
+    pending->length[i] = (uint8_t)lnSimLength;
+}
+
+static void lnSimConsume(lnSimNode_t* node)
+{
+    uint8_t message[127];
+    lnSimSelect(node);
+    uint8_t length;
+    while ((length = lnReceiveMessage(&node->port, message, sizeof(message))) != 0)
+    {
+        lnSimStats.received++;
+#if LN_BULK
+        if (lnSimBulkSize != 0 && node == &lnSimNodes[0])
+        {
+            lnBulkSenderMessage(&lnSimBulkSender, message, length);
+        }
+        else if (lnSimBulkSize != 0 && node == &lnSimNodes[1])
+        {
+            lnBulkReceiverMessage(&lnSimBulkReceiver, message, length);
+        }
+#endif
+    }
+#if LN_BULK
+    if (lnSimBulkSize != 0 && node == &lnSimNodes[0])
+    {
+        lnBulkPollSender(&lnSimBulkSender);
+        lnSimSyncPending(node);
+        lnSimSyncTimer1(node);
+    }
+    else if (lnSimBulkSize != 0 && node == &lnSimNodes[1])
+    {
+        lnBulkPollReceiver(&lnSimBulkReceiver);
+        lnSimSyncPending(node);
+        lnSimSyncTimer1(node);
+    }
+#endif
+#if LN_TX_BUDGET
+    uint8_t tag;
+    uint8_t status;
+    while (lnGetTxStatus(&node->port, &tag, &status))
+    {
+        lnSimStats.completions[status]++;
+    }
+#endif
+}
+
+// </editor-fold>
+
+#if LN_BULK
+// <editor-fold defaultstate="collapsed" desc="bulk transfer">
+
+/**
+ * the byte of the bulk transfer at an offset (all 256 values)
+ * @param offset: the offset in the transfer
+ * @return the value of the byte
+ */
+static uint8_t lnSimBulkByte(uint32_t offset)
+{
+    return (uint8_t)((offset * 167u) ^ (offset >> 8));
+}
+
+static void lnSimBulkRead(lnBulkSender_t* sender, uint32_t offset, uint8_t* data, uint8_t length)
+{
+    for (uint8_t i = 0; i < length; i++)
+    {
+        data[i] = lnSimBulkByte(offset + i);
+    }
+}
+
+static void lnSimBulkWrite(lnBulkReceiver_t* receiver, uint32_t offset, const uint8_t* data,
+        uint8_t length)
+{
+    for (uint8_t i = 0; i < length; i++)
+    {
+        if (offset + i >= lnSimBulkSize || data[i] != lnSimBulkByte(offset + i))
+        {
+            lnSimStats.bulkErrors++;
+        }
+    }
+    lnSimStats.bulkWritten += length;
+}
+
+static void lnSimBulkStart(void)
+{
+    lnBulkInitSender(&lnSimBulkSender, &lnSimNodes[0].port, 1u);
+    lnSimBulkSender.read = lnSimBulkRead;
+    lnSimBulkSender.window = (uint8_t)lnSimBulkWindow;
+    lnBulkInitReceiver(&lnSimBulkReceiver, &lnSimNodes[1].port, 2u);
+    lnSimBulkReceiver.write = lnSimBulkWrite;
+    lnSimSelect(&lnSimNodes[0]);
+    lnBulkSend(&lnSimBulkSender, 2u, 1u, lnSimBulkSize);
+}
+
+static bool lnSimBulkDone(void)
+{
+    return lnSimBulkSender.state != LN_BULK_BUSY;
+}
+
+static void lnSimReportBulk(void)
+{
+    double seconds = lnSimStats.bulkEnd / 1e6;
+    // payload capacity: the data bytes of full blocks back to back
+    double capacity = LN_SIM_BYTES_PER_SECOND * LN_BULK_BLOCK / LN_BULK_MESSAGE;
+    // a transfer that is not done only counts the bytes that arrived
+    double goodput = seconds > 0.0 ? (double)lnSimStats.bulkWritten / seconds : 0.0;
+    const char* state = (lnSimBulkSender.state == LN_BULK_DONE) ? "done" :
+            (lnSimBulkSender.state == LN_BULK_FAILED) ? "failed" : "busy";
+    printf("bulk transfer  : %s, %llu of %u bytes in %.2f s, window %u\n",
+            state, (unsigned long long)lnSimStats.bulkWritten,
+            (unsigned)lnSimBulkSize, seconds, lnSimBulkSender.window);
+    printf("bulk goodput   : %.1f bytes/s (%.1f %% of the payload capacity of "
+            "%.1f bytes/s)\n", goodput, 100.0 * goodput / capacity, capacity);
+    printf("bulk sink      : %llu bytes written, %llu wrong, %u retransmissions, "
+            "%u duplicates\n", (unsigned long long)lnSimStats.bulkWritten,
+            (unsigned long long)lnSimStats.bulkErrors,
+            lnSimBulkSender.retransmissions, lnSimBulkReceiver.duplicates);
+}
+
+// </editor-fold>
+#endif
+
+// <editor-fold defaultstate="collapsed" desc="simulation">
+
+static void lnSimInit(bool firmwareSeed)
+{
+    for (unsigned i = 0; i < lnSimNumNodes; i++)
+    {
+        lnSimNode_t* node = &lnSimNodes[i];
+        memset(node, 0, sizeof(*node));
+        node->txPending = LN_SIM_TXREG_EMPTY;
+        node->rxState = RX_IDLE;
+        node->regs.portcbits.RC7 = true;
+        node->regs.baudconbits.RCIDL = true;
+        node->port.hal = &lnPic18f4620Hal;
+        lnSimSelect(node);
+        lnInit(&node->port);
+#if LN_TX_LIMIT
+        lnSetTxLimit(&node->port, (uint8_t)lnSimThreshold, (uint8_t)lnSimTokenRate,
+                (uint8_t)lnSimBurst);
+#endif
+        lnSimSyncTimer1(node);
+        node->tmr3Start = lnSimNow;
+        node->tmr3Expiry = (node->regs.t3con & 1u) ? lnSimNow + 0x10000u : LN_SIM_NEVER;
+        if (!firmwareSeed)
+        {
+            // the LFSR must never be 0
+            node->port.lastRandomValue = (uint16_t)(lnSimRandom() | 1u);
+        }
+        node->nextArrival = lnSimNextArrival();
+    }
+}
+
+static void lnSimStep(void)
+{
+    uint64_t next = LN_SIM_NEVER;
+    for (unsigned i = 0; i < lnSimNumNodes; i++)
+    {
+        lnSimNode_t* node = &lnSimNodes[i];
+        if (node->tmr1Expiry < next) next = node->tmr1Expiry;
+        if (node->tmr3Expiry < next) next = node->tmr3Expiry;
+        if (node->nextArrival < next) next = node->nextArrival;
+        if (node->txBusy && node->txNextEdge < next) next = node->txNextEdge;
+        if (node->rxState == RX_BUSY && node->rxNextSample < next) next = node->rxNextSample;
+    }
+    lnSimNow = next;
+
+    for (unsigned i = 0; i < lnSimNumNodes; i++)
+    {
+        lnSimNode_t* node = &lnSimNodes[i];
+        if (node->txBusy && node->txNextEdge == lnSimNow)
+        {
+            lnSimTxEdge(node);
+        }
+    }
+    lnSimUpdateBus();
+    for (unsigned i = 0; i < lnSimNumNodes; i++)
+    {
+        lnSimNode_t* node = &lnSimNodes[i];
+        if (node->rxState == RX_BUSY && node->rxNextSample == lnSimNow)
+        {
+            lnSimRxSample(node);
+        }
+        if (node->tmr1Expiry == lnSimNow)
+        {
+            // timer 1 keeps running after the overflow
+            node->regs.pir1bits.TMR1IF = true;
+            node->tmr1Expiry += 0x10000u;
+        }
+        if (node->tmr3Expiry == lnSimNow)
+        {
+            node->regs.pir2bits.TMR3IF = true;
+            node->tmr3Expiry += 0x10000u;
+        }
+        if (node->nextArrival == lnSimNow)
+        {
+            lnSimOffer(node);
+        }
+    }
+    for (unsigned i = 0; i < lnSimNumNodes; i++)
+    {
+        lnSimRunIsr(&lnSimNodes[i]);
+        lnSimConsume(&lnSimNodes[i]);
+    }
+}
+
+/**
+ * add the statistics of a node to the total (high-water marks: maximum)
+ * @param total: the total
+ * @param stats: the statistics of the node
+ */
+static void lnSimAddStats(lnStats_t* total, const lnStats_t* stats)
+{
+    total->txMessages += stats->txMessages;
+    total->rxMessages += stats->rxMessages;
+    total->linebreaks += stats->linebreaks;
+    total->collisions += stats->collisions;
+    total->cmpRestarts += stats->cmpRestarts;
+    total->overruns += stats->overruns;
+    total->rawOverflows += stats->rawOverflows;
+    total->checksumErrors += stats->checksumErrors;
+    total->truncatedMessages += stats->truncatedMessages;
+    total->overrunBytes += stats->overrunBytes;
+    total->badLengths += stats->badLengths;
+    total->rxDropped += stats->rxDropped;
+    total->rxFiltered += stats->rxFiltered;
+    total->rxUnhandled += stats->rxUnhandled;
+    total->txDropped += stats->txDropped;
+    total->txCoalesced += stats->txCoalesced;
+    total->txEvicted += stats->txEvicted;
+    total->txExpired += stats->txExpired;
+    if (stats->rxHighWater > total->rxHighWater)
+    {
+        total->rxHighWater = stats->rxHighWater;
+    }
+    for (unsigned i = 0; i < LN_TX_PRIORITIES; i++)
+    {
+        if (stats->txHighWater[i] > total->txHighWater[i])
+        {
+            total->txHighWater[i] = stats->txHighWater[i];
+        }
+    }
+}
+
+#if LN_LATENCY
+/**
+ * add the latency histograms of a node to the total
+ * @param total: the total
+ * @param latency: the histograms of the node
+ */
+static void lnSimAddLatency(lnLatency_t* total, const lnLatency_t* latency)
+{
+    for (unsigned i = 0; i < LN_TX_PRIORITIES; i++)
+    {
+        for (unsigned j = 0; j < LN_LATENCY_BUCKETS; j++)
+        {
+            total->latency[i][j] += latency->latency[i][j];
+        }
+    }
+    for (unsigned i = 0; i < LN_LATENCY_ATTEMPTS; i++)
+    {
+        total->attempts[i] += latency->attempts[i];
+    }
+}
+
+/**
+ * upper bound of a percentile of a driver latency histogram
+ * @return the upper bound in ms (0 if the histogram is empty)
+ */
+static double lnSimHistogramPercentile(const uint16_t* histogram, double p)
+{
+    uint32_t count = 0;
+    for (unsigned i = 0; i < LN_LATENCY_BUCKETS; i++)
+    {
+        count += histogram[i];
+    }
+    uint32_t sum = 0;
+    for (unsigned i = 0; count != 0 && i < LN_LATENCY_BUCKETS; i++)
+    {
+        sum += histogram[i];
+        if (sum >= p * count)
+        {
+            return (double)(2u << i) * 0.256;
+        }
+    }
+    return 0.0;
+}
+
+static void lnSimReportHistogram(void)
+{
+    static const char* names[LN_TX_PRIORITIES] = { "high", "normal", "low" };
+    for (unsigned i = 0; i < LN_TX_PRIORITIES; i++)
+    {
+        const uint16_t* histogram = lnSimStats.histogram.latency[i];
+        if (lnSimHistogramPercentile(histogram, 1.0) != 0.0)
+        {
+            printf("hist. %-9s: p50 < %.1f ms, p99 < %.1f ms, max < %.1f ms\n",
+                    names[i], lnSimHistogramPercentile(histogram, 0.50),
+                    lnSimHistogramPercentile(histogram, 0.99),
+                    lnSimHistogramPercentile(histogram, 1.0));
+        }
+    }
+    printf("attempts       :");
+    for (unsigned i = 0; i < LN_LATENCY_ATTEMPTS; i++)
+    {
+        printf(" %u%s:%u", i + 1, (i == LN_LATENCY_ATTEMPTS - 1) ? "+" : "",
+                lnSimStats.histogram.attempts[i]);
+    }
+    printf("\n");
+}
+#endif
+
+static int lnSimCompare(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static double lnSimPercentile(lnSimLatency_t* latency, double p)
+{
+    if (latency->count == 0)
+    {
+        return 0.0;
+    }
+    size_t i = (size_t)(p * (double)(latency->count - 1) + 0.5);
+    return latency->values[i] / 1000.0;
+}
+
+static void lnSimReportLatency(const char* name, lnSimLatency_t* latency)
+{
+    qsort(latency->values, latency->count, sizeof(uint32_t), lnSimCompare);
+    printf("%-15s: p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms (%zu messages)\n",
+            name, lnSimPercentile(latency, 0.50), lnSimPercentile(latency, 0.90),
+            lnSimPercentile(latency, 0.99), lnSimPercentile(latency, 1.0),
+            latency->count);
+}
+
+static void lnSimReport(double seconds, double load)
+{
+    double goodput = lnSimStats.transmittedBytes / seconds;
+    printf("nodes          : %u\n", lnSimNumNodes);
+    printf("duration       : %.1f s\n", seconds);
+    printf("offered load   : %.1f %% (%u byte messages, %.2f msg/s per node)\n",
+            100.0 * load, lnSimLength, lnSimRate);
+    printf("backoff        : %s\n", (LN_BACKOFF == LN_BACKOFF_ADAPTIVE) ? "adaptive" : "fixed");
+    printf("offered        : %llu messages\n", (unsigned long long)lnSimStats.offered);
+    printf("dropped        : %llu messages (TX queue full)\n", (unsigned long long)lnSimStats.dropped);
+    printf("transmitted    : %llu messages\n", (unsigned long long)lnSimStats.transmitted);
+    printf("received       : %llu messages (%.1f per transmitted message)\n",
+            (unsigned long long)lnSimStats.received,
+            lnSimStats.transmitted ? (double)lnSimStats.received / lnSimStats.transmitted : 0.0);
+    printf("goodput        : %.1f bytes/s (%.1f %% of %.1f bytes/s)\n",
+            goodput, 100.0 * goodput / LN_SIM_BYTES_PER_SECOND, LN_SIM_BYTES_PER_SECOND);
+#if LN_BUS_LOAD
+    printf("bus load       : %.1f %% (estimate of the driver, mean of the nodes)\n",
+            (double)lnSimStats.busLoad / lnSimNumNodes);
+#endif
+#if LN_TX_LIMIT
+    if (lnSimThreshold != 0)
+    {
+        printf("TX limiter     : from %u %% bus load, %u %% token rate, %u byte burst\n",
+                lnSimThreshold, lnSimTokenRate, lnSimBurst);
+    }
+#endif
+    printf("collisions     : %llu\n", (unsigned long long)lnSimStats.collisions);
+    printf("linebreaks     : %llu\n", (unsigned long long)lnSimStats.linebreaks);
+    printf("framing errors : %llu\n", (unsigned long long)lnSimStats.framingErrors);
+    printf("overruns       : %llu\n", (unsigned long long)lnSimStats.overruns);
+    printf("timer 1        : %.1f interrupts/s per node\n",
+            lnSimStats.tmr1Interrupts / seconds / lnSimNumNodes);
+    printf("malformed      : %u checksum, %u truncated, %u overrun bytes, %u bad length\n",
+            lnSimStats.driver.checksumErrors, lnSimStats.driver.truncatedMessages,
+            lnSimStats.driver.overrunBytes, lnSimStats.driver.badLengths);
+    printf("driver         : %u tx, %u rx, %u linebreaks, %u collisions, "
+            "%u CMP restarts, %u overruns (%u raw ring), %u/%u dropped (rx/tx), %u filtered, "
+            "%u unhandled, %u coalesced, %u evicted, %u expired\n",
+            lnSimStats.driver.txMessages, lnSimStats.driver.rxMessages,
+            lnSimStats.driver.linebreaks, lnSimStats.driver.collisions,
+            lnSimStats.driver.cmpRestarts, lnSimStats.driver.overruns,
+            lnSimStats.driver.rawOverflows,
+            lnSimStats.driver.rxDropped, lnSimStats.driver.txDropped,
+            lnSimStats.driver.rxFiltered, lnSimStats.driver.rxUnhandled,
+            lnSimStats.driver.txCoalesced,
+            lnSimStats.driver.txEvicted, lnSimStats.driver.txExpired);
+    printf("high-water     : %u bytes rx, %u/%u/%u bytes tx (high/normal/low)\n",
+            lnSimStats.driver.rxHighWater, lnSimStats.driver.txHighWater[LN_PRIORITY_HIGH],
+            lnSimStats.driver.txHighWater[LN_PRIORITY_NORMAL],
+            lnSimStats.driver.txHighWater[LN_PRIORITY_LOW]);
+    if (lnSimStats.latency[LN_PRIORITY_HIGH].count != 0)
+    {
+        lnSimReportLatency("latency high", &lnSimStats.latency[LN_PRIORITY_HIGH]);
+    }
+    lnSimReportLatency("latency", &lnSimStats.latency[LN_PRIORITY_NORMAL]);
+    if (lnSimStats.latency[LN_PRIORITY_LOW].count != 0)
+    {
+        lnSimReportLatency("latency low", &lnSimStats.latency[LN_PRIORITY_LOW]);
+    }
+#if LN_BULK
+    if (lnSimBulkSize != 0)
+    {
+        lnSimReportBulk();
+    }
+#endif
+#if LN_TX_BUDGET
+    if (lnSimAttempts != 0 || lnSimDeadline > 0.0)
+    {
+        printf("TX budget      : %u attempts, %.1f ms deadline: %llu sent, "
+                "%llu out of attempts, %llu past deadline, %llu evicted (%llu lost)\n",
+                lnSimAttempts, lnSimDeadline,
+                (unsigned long long)lnSimStats.completions[LN_TX_SENT],
+                (unsigned long long)lnSimStats.completions[LN_TX_ATTEMPTS],
+                (unsigned long long)lnSimStats.completions[LN_TX_DEADLINE],
+                (unsigned long long)lnSimStats.completions[LN_TX_EVICTED],
+                (unsigned long long)lnSimStats.statusLost);
+    }
+#endif
+#if LN_LATENCY
+    lnSimReportHistogram();
+#endif
+}
+
+static void lnSimUsage(void)
+{
+    fprintf(stderr,
+            "usage: lnsim [-n nodes] [-l load | -r rate] [-L length] [-t seconds]\n"
+            "             [-H share] [-W share] [-A addresses] [-s seed] [-u]\n"
+            "             [-b attempts] [-d deadline] [-T threshold] [-G rate] [-B burst]\n"
+            "             [-X bytes] [-w window]\n"
+            "  -n  number of nodes on the bus (default 8, max %u)\n"
+            "  -l  offered load as a fraction of the bus capacity (default 0.3)\n"
+            "  -r  offered messages per second per node (overrides -l)\n"
+            "  -L  message length in bytes: 2, 4, 6 or 7..127 (default 4)\n"
+            "  -t  simulated time in seconds (default 60)\n"
+            "  -H  share of the messages sent with high priority (default 0)\n"
+            "  -W  share of the messages sent with low priority (default 0)\n"
+            "  -A  switch addresses used by 4 byte messages (default 2048)\n"
+            "  -s  seed of the simulator (default 1)\n"
+            "  -u  keep the firmware seed of the driver LFSR on every node\n",
+            LN_SIM_MAX_NODES);
+#if LN_TX_BUDGET
+    fprintf(stderr,
+            "  -b  TX budget: maximum attempts of every message (default 0: no limit)\n"
+            "  -d  TX budget: deadline of every message in ms (default 0: none)\n");
+#endif
+#if LN_TX_LIMIT
+    fprintf(stderr,
+            "  -T  TX limiter: bus load in %% that holds back normal and low\n"
+            "      priority messages (default 0: off)\n"
+            "  -G  TX limiter: token rate in %% of the bus capacity (default %u)\n"
+            "  -B  TX limiter: token bucket size in bytes (default %u)\n",
+            LN_TX_LIMIT_RATE, LN_TX_LIMIT_BURST);
+#endif
+#if LN_BULK
+    fprintf(stderr,
+            "  -X  bulk transfer of a number of bytes from node 0 to node 1\n"
+            "      (default 0: none, the offered load can be 0)\n"
+            "  -w  window of the bulk transfer in blocks (default %u, 1: stop and\n"
+            "      wait)\n",
+            LN_BULK_WINDOW);
+#endif
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+    double load = 0.3;
+    double seconds = 60.0;
+    bool firmwareSeed = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:l:r:L:t:H:W:A:s:ub:d:T:G:B:X:w:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': lnSimNumNodes = (unsigned)atoi(optarg); break;
+            case 'l': load = atof(optarg); break;
+            case 'r': lnSimRate = atof(optarg); break;
+            case 'L': lnSimLength = (unsigned)atoi(optarg); break;
+            case 't': seconds = atof(optarg); break;
+            case 'H': lnSimHighShare = atof(optarg); break;
+            case 'W': lnSimLowShare = atof(optarg); break;
+            case 'A': lnSimAddresses = (unsigned)atoi(optarg); break;
+            case 's': lnSimSeed = strtoull(optarg, NULL, 0) | 1u; break;
+            case 'u': firmwareSeed = true; break;
+#if LN_TX_BUDGET
+            case 'b': lnSimAttempts = (unsigned)atoi(optarg); break;
+            case 'd': lnSimDeadline = atof(optarg); break;
+#endif
+#if LN_TX_LIMIT
+            case 'T': lnSimThreshold = (unsigned)atoi(optarg); break;
+            case 'G': lnSimTokenRate = (unsigned)atoi(optarg); break;
+            case 'B': lnSimBurst = (unsigned)atoi(optarg); break;
+#endif
+#if LN_BULK
+            case 'X': lnSimBulkSize = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'w': lnSimBulkWindow = (unsigned)atoi(optarg); break;
+#endif
+            default: lnSimUsage();
+        }
+    }
+    if (lnSimNumNodes < 1 || lnSimNumNodes > LN_SIM_MAX_NODES ||
+            lnSimLength < 2 || lnSimLength > 127 || lnSimLength == 3 ||
+            lnSimLength == 5 || seconds <= 0.0 ||
+            lnSimHighShare < 0.0 || lnSimLowShare < 0.0 ||
+            lnSimHighShare + lnSimLowShare > 1.0 ||
+            lnSimAddresses < 1 || lnSimAddresses > 2048
+#if LN_TX_BUDGET
+            || lnSimAttempts > 255 || lnSimDeadline < 0.0 ||
+            lnSimDeadline * 1000.0 / 256.0 > 32767.0
+#endif
+#if LN_TX_LIMIT
+            || lnSimThreshold > 100 || lnSimTokenRate > 100 || lnSimBurst > 255
+#endif
+#if LN_BULK
+            || lnSimBulkWindow < 1 || lnSimBulkWindow > LN_BULK_WINDOW ||
+            (lnSimBulkSize != 0 && lnSimNumNodes < 2) ||
+            lnSimBulkSize > 0xffffu * LN_BULK_BLOCK
+#endif
+            )
+    {
+        lnSimUsage();
+    }
+    if (lnSimRate > 0.0)
+    {
+        load = lnSimRate * lnSimNumNodes * lnSimLength / LN_SIM_BYTES_PER_SECOND;
+    }
+    else if (load > 0.0)
+    {
+        lnSimRate = load * LN_SIM_BYTES_PER_SECOND / lnSimLength / lnSimNumNodes;
+    }
+#if LN_BULK
+    else if (lnSimBulkSize != 0)
+    {
+        lnSimRate = 0.0;
+        load = 0.0;
+    }
+#endif
+    else
+    {
+        lnSimUsage();
+    }
+
+    lnSimInit(firmwareSeed);
+#if LN_BULK
+    if (lnSimBulkSize != 0)
+    {
+        lnSimBulkStart();
+    }
+#endif
+    uint64_t end = (uint64_t)(seconds * 1e6);
+    while (lnSimNow < end)
+    {
+        lnSimStep();
+#if LN_BULK
+        if (lnSimBulkSize != 0 && lnSimBulkDone())
+        {
+            // the report covers the time of the transfer
+            lnSimStats.bulkEnd = lnSimNow;
+            seconds = lnSimNow / 1e6;
+            break;
+        }
+#endif
+    }
+#if LN_BULK
+    if (lnSimBulkSize != 0 && !lnSimBulkDone())
+    {
+        lnSimStats.bulkEnd = lnSimNow;
+    }
+#endif
+    for (unsigned i = 0; i < lnSimNumNodes; i++)
+    {
+        lnStats_t stats;
+        lnGetStats(&lnSimNodes[i].port, &stats, false);
+        lnSimAddStats(&lnSimStats.driver, &stats);
+#if LN_LATENCY
+        lnLatency_t latency;
+        lnGetLatency(&lnSimNodes[i].port, &latency, false);
+        lnSimAddLatency(&lnSimStats.histogram, &latency);
+#endif
+#if LN_TX_BUDGET
+        lnSimStats.statusLost += lnSimNodes[i].port.txStatus.lost;
+#endif
+#if LN_BUS_LOAD
+        lnSimSelect(&lnSimNodes[i]);
+        lnSimStats.busLoad += lnGetBusLoad(&lnSimNodes[i].port);
+#endif
+    }
+    lnSimReport(seconds, load);
+    return EXIT_SUCCESS;
+}
+
+// </editor-fold>
@@ -0,0 +1,103 @@
+/*
+ * file: xc.h
+ * author: Geert Giebens, Jan van Hooydonk
+ * comments: LocoNet driver - host hardware abstraction layer
+ *
+ * this header replaces the XC8 processor header when the driver is built on
+ * a (Linux) host. Every special function register that the driver touches is
+ * mapped onto a register file (lnSimRegs_t) owned by the simulator, so the
+ * driver sources compile unmodified. Registers with side effects on the
+ * PIC18F4620 (reading RCREG, writing timer 1, reading timer 3) are mapped
+ * onto functions of the simulator.
+ *
+ * revision history:
+ *  v1.0 Creation (16/10/2026)
+ */
+
+#ifndef HOST_XC_H
+#define	HOST_XC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// TXREG holds this value as long as the driver did not write a new byte
+#define LN_SIM_TXREG_EMPTY 0x100u
+
+typedef struct lnSimRegs_t
+{
+    uint8_t cmcon;
+    uint8_t tmr1h;
+    uint8_t tmr1l;
+    uint8_t t1con;
+    uint8_t tmr3h;
+    uint8_t tmr3l;
+    uint8_t t3con;
+    uint8_t spbrg;
+    uint8_t spbrgh;
+    uint16_t txreg;
+    struct { unsigned RA4 :1; unsigned RA5 :1; } trisabits;
+    struct { unsigned RC6 :1; unsigned RC7 :1; } triscbits;
+    struct { unsigned LATA5 :1; } latabits;
+    struct { unsigned RC6 :1; unsigned RC7 :1; } portcbits;
+    struct { unsigned BRG16 :1; unsigned TXCKP :1; unsigned RCIDL :1; } baudconbits;
+    struct { unsigned SYNC :1; unsigned BRGH :1; unsigned TXEN :1; } txstabits;
+    struct { unsigned SPEN :1; unsigned CREN :1; unsigned FERR :1; unsigned OERR :1; } rcstabits;
+    struct { unsigned TMR1ON :1; } t1conbits;
+    struct { unsigned TMR1IP :1; unsigned TMR2IP :1; unsigned RCIP :1; } ipr1bits;
+    struct { unsigned TMR3IP :1; } ipr2bits;
+    struct { unsigned IPEN :1; } rconbits;
+    struct { unsigned GIEH :1; unsigned GIEL :1; } intconbits;
+    struct { unsigned TMR1IE :1; unsigned TMR2IE :1; unsigned RCIE :1; } pie1bits;
+    struct { unsigned TMR1IF :1; unsigned TMR2IF :1; unsigned RCIF :1; } pir1bits;
+    struct { unsigned TMR3IE :1; } pie2bits;
+    struct { unsigned TMR3IF :1; } pir2bits;
+} lnSimRegs_t;
+
+// register file of the node that is currently executing driver code
+extern lnSimRegs_t* lnSimRegs;
+
+uint8_t lnSimReadRcreg(void);
+void lnSimWriteTimer1(uint16_t);
+uint8_t* lnSimTimer3High(void);
+
+#define CMCON       (lnSimRegs->cmcon)
+#define TMR1H       (lnSimRegs->tmr1h)
+#define TMR1L       (lnSimRegs->tmr1l)
+#define T1CON       (lnSimRegs->t1con)
+#define TMR3L       (lnSimRegs->tmr3l)
+#define T3CON       (lnSimRegs->t3con)
+#define SPBRG       (lnSimRegs->spbrg)
+#define SPBRGH      (lnSimRegs->spbrgh)
+#define TXREG       (lnSimRegs->txreg)
+#define TRISAbits   (lnSimRegs->trisabits)
+#define TRISCbits   (lnSimRegs->triscbits)
+#define LATAbits    (lnSimRegs->latabits)
+#define PORTCbits   (lnSimRegs->portcbits)
+#define BAUDCONbits (lnSimRegs->baudconbits)
+#define TXSTAbits   (lnSimRegs->txstabits)
+#define RCSTAbits   (lnSimRegs->rcstabits)
+#define T1CONbits   (lnSimRegs->t1conbits)
+#define IPR1bits    (lnSimRegs->ipr1bits)
+#define IPR2bits    (lnSimRegs->ipr2bits)
+#define RCONbits    (lnSimRegs->rconbits)
+#define INTCONbits  (lnSimRegs->intconbits)
+#define PIE1bits    (lnSimRegs->pie1bits)
+#define PIR1bits    (lnSimRegs->pir1bits)
+#define PIE2bits    (lnSimRegs->pie2bits)
+#define PIR2bits    (lnSimRegs->pir2bits)
+
+// reading RCREG pops the receive FIFO (and updates FERR and RCIF)
+#define RCREG (lnSimReadRcreg())
+#define WRITETIMER1(x) lnSimWriteTimer1((uint16_t)(x))
+// TMR3H follows the simulated time (timer 3 runs free from lnInit on)
+#define TMR3H (*lnSimTimer3High())
+
+// the host has no interrupt vectors, the simulator calls the ISRs itself
+#define __interrupt(x)
+#define di()
+#define ei()
+#define NOP()
+// busy waiting does not advance the simulated time
+#define _delay(x)
+
+#endif	/* HOST_XC_H */
@@ -5,133 +5,194 @@
  * 
  */
 
+#include <string.h>
 #include "ln.h"
+#if LN_RX_FILTER
+#include "ln_dispatch.h"
+#endif
+
+// priority delay per TX priority class: offset + (random value & mask) s
+const struct
+{
+    uint16_t offset;
+    uint16_t mask;
+} lnPriorityDelay[LN_TX_PRIORITIES] =
+{
+    { 0u, 255u },                   // high: 0s ... 255s
+    { 0u, 1023u },                  // normal: 0s ... 1023s
+    { 256u, 1023u }                 // low: 256s ... 1279s
+};
 
 // <editor-fold defaultstate="collapsed" desc="initialisation">
 
-void lnInit(void)
+void lnInit(lnPort_t* port)
 {
     // declaration and initialisation (= malloc) of the RX and TX queue
     // essentially the queue is just a pointer to the instance of the struct
-    initQueue(&lnTxQueue);
-    initQueue(&lnTxTempQueue);
-    initQueue(&lnRxQueue);
-    initQueue(&lnRxTempQueue);
+    for (uint8_t i = 0; i < LN_TX_PRIORITIES; i++)
+    {
+        initMessageQueue(&port->txQueue[i]);
+    }
+    initMessageQueue(&port->rxQueue);
+    
+    port->rawRing.head = 0;
+    port->rawRing.tail = 0;
+#if LN_SLOT_CACHE
+    for (uint8_t i = 0; i < LN_SLOTS; i++)
+    {
+        port->slots[i].age = LN_SLOT_UNKNOWN;
+    }
+#endif
+#if LN_STATE_CACHE
+    memset((void*)&port->stateCache, 0, sizeof(lnStateCache_t));
+#endif
+#if LN_TX_BUDGET
+    memset(&port->txNextBudget, 0, sizeof(lnTxBudget_t));
+    port->txStatus.head = 0;
+    port->txStatus.tail = 0;
+    port->txStatus.lost = 0;
+#endif
+    
+    // initialisation of the hardware of the port (comparator, EUSART,
+    // timers, ISR, leds)
+    port->hal->init(port);
+#if LN_TRACE
+    port->trace.head = 0;
+    port->trace.tail = 0;
+    port->trace.lost = 0;
+    port->traceTime = port->hal->getMicros(port);
+#endif
+#if LN_BUS_LOAD
+    memset((void*)&port->busLoad, 0, sizeof(lnBusLoad_t));
+    port->busLoad.start = port->hal->getTime(port);
+#if LN_TX_LIMIT
+    lnSetTxLimit(port, LN_TX_LIMIT_THRESHOLD, LN_TX_LIMIT_RATE, LN_TX_LIMIT_BURST);
+#endif
+#endif
     
-    // initialisation of the other elements (comparator, EUSART, timer 1, ISR)
-    lnInitComparator();
-    lnInitEusart();
-    lnInitTmr1();
-    lnInitIsr();
-    lnInitLeds();
+    // initial value for the random generator
+    port->lastRandomValue = 1234u;
+    
+    // start the CMP delay (LN could be in use)
+    startCmpDelay(port);
     return;
 }
 
-void lnInitComparator(void)
-{
-    CMCON = 0b00000001;         // one indipendent comparator with output
-                                // C1 Vin- = RA0
-                                // C1 Vin+ = RA3
-                                // C1 Vout = RA4
-    TRISAbits.RA4 = false;      // PORTA 4 = comparator output
-    return;
-}
+// </editor-fold>
 
-void lnInitEusart(void)
-{
-    // set pins for EUSART RX and TX
-    TRISCbits.RC6 = false;      // PORTC 6 = LN TX
-    TRISCbits.RC7 = true;       // PORTC 7 = LN RX
-    
-    // configure EUSART
-    setBRG();
-    BAUDCONbits.BRG16 = true;   // 16-bit baudrate generator
-    BAUDCONbits.TXCKP = true;   // invert TX output signal
-    TXSTAbits.SYNC = false;     // asynchronous mode
-    TXSTAbits.BRGH = false;     // low speed
-    TXSTAbits.TXEN = true;      // enable transmitter
-    RCSTAbits.CREN = false;     // clear bit CREN to clear the OERR bit
-    RCSTAbits.CREN = true;      // enable receiver
-    _ = RCREG;                  // read the receive register to clear his
-                                // content and to clear the FERR bit
-    RCSTAbits.SPEN = true;      // enable serial port
-    return;
-}
+// <editor-fold defaultstate="collapsed" desc="ISR">
 
-void lnInitTmr1(void)
-{
-    TMR1H = 0x00;               // reset timer1
-    TMR1L = 0x00;
-    T1CON = 0b00110000;         // RD16 = 0 (timer1 in 8 bit operation)
-                                // T1RUN = 0 (driven by another source)
-                                // T1CKPS = 0b11 (1:8 prescaler)
-                                // T1OSCEN = 0 (oscillator is disabled)
-                                // T1SYNC = 0 (ignored)
-                                // TMR1CS = 0 (source: internal clock = FOSC/4)
-                                // TMR1ON = 0 (timer1 is disabled)
-    return;
-}
+// <editor-fold defaultstate="collapsed" desc="ISR top half">
 
-void lnInitIsr(void)
+/**
+ * put a byte or a receiver error on the raw ring (top half)
+ * @param value: the received byte
+ * @param event: LN_RAW_DATA, LN_RAW_FERR or LN_RAW_OERR
+ */
+void pushRaw(lnPort_t* port, uint8_t value, uint8_t event)
 {
-    IPR1bits.TMR1IP = 0;        // timer1 interrupt low priority
-    IPR1bits.RCIP = 0;          // rxd interrupt low priority
-    RCONbits.IPEN = 1;          // enable priority levels on iterrupt
-    INTCONbits.GIEH = 1;        // enable all high priority interrupts
-    INTCONbits.GIEL = 1;        // enable all low priority interrupts
-    PIE1bits.RCIE = 1;          // enable rxd interrupt
-    PIE1bits.TMR1IE = 1;        // enable timer 1 overflow interrupt
-
-    T1CONbits.TMR1ON = 1;       // enable timer 1
-    lastRandomValue = 1234u;    // set a random value != 0
-    startCmpDelay();            // start LN driver with CMP delay
-    return;
+#if LN_TRACE
+    pushTrace(port, value, event);
+#endif
+    uint8_t tail = port->rawRing.tail;
+    if (((tail + 1) & LN_RAW_MASK) == port->rawRing.head)
+    {
+        // the bottom half is more than LN_RAW_SIZE bytes behind
+        port->stats.rawOverflows++;
+        return;
+    }
+    port->rawRing.values[tail] = value;
+    port->rawRing.events[tail] = event;
+    port->rawRing.tail = (tail + 1) & LN_RAW_MASK;
 }
 
-void lnInitLeds(void)
+#if LN_TRACE
+/**
+ * put a byte or a receiver error with its timestamp on the trace ring (top
+ * half), a gap of more than 65535s takes an extra LN_TRACE_IDLE record
+ * @param value: the received byte
+ * @param event: LN_RAW_DATA, LN_RAW_FERR or LN_RAW_OERR
+ */
+void pushTrace(lnPort_t* port, uint8_t value, uint8_t event)
 {
-    TRISAbits.RA5 = 0;          // A5 as output
-    LATAbits.LATA5 = 1;         // led 'data on LN' on (active low))
+    uint32_t now = port->hal->getMicros(port);
+    uint32_t gap = (now - port->traceTime) & LN_TRACE_GAP_MASK;
+    uint8_t tail = port->trace.tail;
+    uint8_t room = (port->trace.head - tail - 1) & LN_TRACE_MASK;
+    if (room < ((gap > 0xffffu) ? 2 : 1))
+    {
+        // the trace is not read fast enough, the gap of the next record
+        // includes this one
+        port->trace.lost++;
+        return;
+    }
+    volatile lnTraceRecord_t* record = &port->trace.records[tail];
+    if (gap > 0xffffu)
+    {
+        record->delta[0] = (uint8_t)(gap >> 16);
+        record->delta[1] = 0;
+        record->event = LN_TRACE_IDLE;
+        record->value = 0;
+        tail = (tail + 1) & LN_TRACE_MASK;
+        record = &port->trace.records[tail];
+    }
+    record->delta[0] = (uint8_t)gap;
+    record->delta[1] = (uint8_t)(gap >> 8);
+    record->event = event;
+    record->value = value;
+    port->trace.tail = (tail + 1) & LN_TRACE_MASK;
+    port->traceTime = now;
 }
+#endif
 
 // </editor-fold>
 
-// <editor-fold defaultstate="collapsed" desc="ISR">
-
-// <editor-fold defaultstate="collapsed" desc="ISR low priority">
+// <editor-fold defaultstate="collapsed" desc="ISR bottom half">
 
-// there are two possible low interrupt triggers, coming from
-// the EUSART data receiver and/or coming from the timer 1 overrun flag
-void __interrupt(low_priority) lnIsr(void)
+/**
+ * bottom half of the EUSART RC interrupt: process the raw ring
+ */
+void lnIsrRaw(lnPort_t* port)
 {
-    if (PIE1bits.TMR1IE && PIR1bits.TMR1IF)
+    while (port->rawRing.head != port->rawRing.tail)
     {
-        // timer 1 interrupt
-        // clear the interrupt flag and handle the request
-        PIR1bits.TMR1IF = 0;
-        lnIsrTmr1();
-    }
-    else if (PIE1bits.RCIE)
-    {
-        // EUSART RC interupt
-        if (RCSTAbits.FERR)
+        uint8_t head = port->rawRing.head;
+        uint8_t value = port->rawRing.values[head];
+        uint8_t event = port->rawRing.events[head];
+        port->rawRing.head = (head + 1) & LN_RAW_MASK;
+#if LN_BUS_LOAD
+        // every event of the receiver is a byte time on LN, a framing error
+        // is a linebreak
+        updateBusLoad(port);
+        port->busLoad.current += (event == LN_RAW_FERR) ? LN_LOAD_LINEBREAK : 1u;
+#endif
+        if (event == LN_RAW_OERR)
+        {
+            port->stats.overruns++;
+            // the LN message in reception is incomplete, discard it
+            port->rxParser.count = 0;
+            if (port->LNCONbits.TX_MODE)
+            {
+                // the echo of the LN message in transmission is lost
+                startLinebreak(port, 900u);
+            }
+        }
+        else if (event == LN_RAW_FERR)
         {
             // EUSART framing error (linebreak detected)
-            // read RCREG to clear the FERR bit
-            _ = RCREG;
-            // retreive (recover) the last transmitted LN message
-            recoverLnMessage(&lnTxTempQueue);
+            port->stats.linebreaks++;
+            // the last transmitted LN message is recovered by the linebreak
             // this framing error detection takes about 600s
             // (10bits x 60s) and a linebreak duration is specified at
             // 900s, so add 300s after this detection time to complete
             // a full linebreak
-            startLinebreak(300u);
+            startLinebreak(port, 300u);
         }
         else
         {
             // EUSART data received
             // handle the received data byte
-            lnIsrRc();
+            lnIsrRc(port, value);
         }
     }
 }
@@ -143,65 +204,90 @@ void __interrupt(low_priority) lnIsr(void)
 /**
  * interrupt routine for Timer 1
  */
-void lnIsrTmr1(void)
+void lnIsrTmr1(lnPort_t* port)
 {
-    switch (LNCONbits.TMR1_MODE)
+#if LN_TX_BUDGET
+    if (port->LNCONbits.TMR1_MODE <= 1 && !port->LNCONbits.TX_MODE)
+    {
+        // no LN message in transmission: remove the LN messages out of
+        // budget before the next attempt
+        expireTxMessages(port);
+    }
+#endif
+    switch (port->LNCONbits.TMR1_MODE)
     {
         case 0:
             // LN driver is in idle mode
-            if (isLnFree())
+            if (port->LNCONbits.TX_MODE)
+            {
+                // the echo of the last transmitted byte is lost
+                port->stats.collisions++;
+                startLinebreak(port, 900u);
+            }
+            else if (isLnFree(port))
             {
                 // LN is free
-                if (!isQueueEmpty(&lnTxTempQueue))
+                uint8_t priority = getTxPriority(port);
+#if LN_TX_LIMIT
+                if (priority < LN_TX_PRIORITIES && isTxLimited(port, priority))
                 {
-                    // if LN TX temporary queue is not empty restart
-                    // the tramsmission (there is still something to be sent)
-                    // this may occur when the last TX message was transmitted
-                    // with errors (eg. after linebreak, conflict RX-TX, ...)
-                    // start sync BRG before transmitting the first data byte
-                    startSyncBRG();
+                    // the LN message is held back by the TX limiter, poll
+                    // again after the idle delay
+                    startIdleDelay(port);
                 }
-                else if (!isQueueEmpty(&lnTxQueue))
+                else
+#endif
+                if (priority < LN_TX_PRIORITIES)
                 {
-                    // if LN TX queue has a LN message 
-                    startTxLnMessage();
+                    // if a LN TX queue has a LN message (a new one or one
+                    // that was transmitted with errors, eg. after linebreak,
+                    // conflict RX-TX, ...) start the transmission of the
+                    // LN message with the highest priority
+                    startTxLnMessage(port, priority);
                 }
                 else
                 {
                     // LN is free but nothing has to be transmitted
+#if LN_TICKLESS
+                    // stop timer 1 until there is something to do
+                    stopTmr1(port);
+#else
                     // restart timer 1 with idle delay
-                    startIdleDelay();
+                    startIdleDelay(port);
+#endif
                 }
             }
             else
             {
                 // LN is not free, so start timer 1 with CMP delay
-                startCmpDelay();
+                port->stats.cmpRestarts++;
+                startCmpDelay(port);
             }
             break;
         case 1:
             // after the CMP delay
-            if (isLnFree())
+            if (isLnFree(port))
             {
                 // if LN line is free start timer 1 with idle delay
-                startIdleDelay();
+                startIdleDelay(port);
             }
             else
             {
                 // if LN line is not free restart timer 1 with CMP delay
-                startCmpDelay();
+                port->stats.cmpRestarts++;
+                startCmpDelay(port);
             }
             break;
         case 2:
             // after the linebreak (delay) start CMP delay
-            RCSTAbits.SPEN = true;      // (re-)enable the receiver
-            PORTCbits.RC6 = false;      // and restore output pin
-            startCmpDelay();            // start the timer 1 with CMP delay
+            // (re-)enable the receiver and restore output pin
+            port->hal->setLinebreak(port, false);
+            startCmpDelay(port);            // start the timer 1 with CMP delay
             break;
         case 3:
             // after the synchronisation of the BRG start sending the LN message
-            LNCONbits.TMR1_MODE = 0;
-            txHandler();
+            port->LNCONbits.TMR1_MODE = 0;
+            txHandler(port);
             break;
         default:
             break;
@@ -212,42 +298,73 @@ void lnIsrTmr1(void)
 
 // <editor-fold defaultstate="collapsed" desc="ISR RX">
 
-void lnIsrRc(void)
+/**
+ * handle a received byte (bottom half)
+ * @param lnRxData: the received byte
+ */
+void lnIsrRc(lnPort_t* port, uint8_t lnRxData)
 {
-    // get the received value
-    uint8_t lnRxData = RCREG;
+    volatile lnMessageQueue_t* txQueue = &port->txQueue[port->LNCONbits.TX_PRIORITY];
 
-    if (!isQueueEmpty(&lnTxTempQueue))
+    if (port->LNCONbits.TX_MODE)
     {
         // device is in TX mode
         // check if received byte = transmitted byte
-        if (lnRxData == lnTxTempQueue.values[lnTxTempQueue.head])
+        if (lnRxData == getNextMessageByte(txQueue))
         {
-            // if last value is correct transmitted then dequeue
-            deQueue(&lnTxTempQueue);
-            if (!isQueueEmpty(&lnTxTempQueue))
+            // if last value is correct transmitted then move the cursor,
+            // after the last byte the LN message is removed from the queue
+            // (and the cursor is back at the start of the next message)
+#if LN_LATENCY || LN_TX_BUDGET
+            uint8_t msgHead = txQueue->msgHead;
+#endif
+#if LN_TX_LIMIT
+            uint8_t length = getMessageLength(txQueue);
+#endif
+#if LN_CACHE
+            if (txQueue->cursor + 1 == getMessageLength(txQueue))
+            {
+                // the LN message is on LN (the echo is not parsed)
+                cacheTxMessage(port, txQueue);
+            }
+#endif
+            deQueueMessageByte(txQueue);
+            if (txQueue->cursor != 0)
             {
-                // send next data of LN message untill queue is empty
-                txHandler();
+                // send next data of LN message
+                txHandler(port);
             }
             else
             {
-                // restart CMP delay
-                startCmpDelay();
+                // LN message is transmitted, restart CMP delay
+                port->LNCONbits.TX_MODE = 0;
+                port->LNCONbits.BACKOFF = 0;
+                port->stats.txMessages++;
+#if LN_LATENCY
+                updateLatency(port, port->LNCONbits.TX_PRIORITY, msgHead);
+#endif
+#if LN_TX_BUDGET
+                completeTxMessage(port, port->LNCONbits.TX_PRIORITY, msgHead, LN_TX_SENT);
+#endif
+#if LN_TX_LIMIT
+                takeTxTokens(port, port->LNCONbits.TX_PRIORITY, length);
+#endif
+                startCmpDelay(port);
             }
         }
         else
         {
             // if LN RX data is not equal to LN TX data send linebreak
-            startLinebreak(900u);
+            port->stats.collisions++;
+            startLinebreak(port, 900u);
         }
     }
     else
     {
         // device is in RX mode (receive LN message)
-        rxHandler(lnRxData);
+        rxHandler(port, lnRxData);
         // restart CMP delay
-        startCmpDelay();
+        startCmpDelay(port);
     }
 }
 
@@ -257,142 +374,1192 @@ void lnIsrRc(void)
 
 // <editor-fold defaultstate="collapsed" desc="RX routines">
 
-void rxHandler(uint8_t lnRxData)
+/**
+ * streaming LN message parser, called for every received byte
+ * the length of the LN message is decoded once (from the opcode or from the
+ * second byte) and the checksum is calculated while the bytes come in, so
+ * the work per byte does not depend on the length of the LN message
+ * the bytes are written directly in reserved space of the LN RX queue, the
+ * LN message is published (committed) only if the checksum is correct
+ * @param lnRxData: the received byte
+ */
+void rxHandler(lnPort_t* port, uint8_t lnRxData)
 {
     // start testing if msb = 1 (this is the startbyte of the LN message)
     if ((lnRxData & 0x80) == 0x80)
     {
-        clearQueue(&lnRxTempQueue);
-        enQueue(&lnRxTempQueue, lnRxData);
+        if (port->rxParser.count != 0)
+        {
+            // the previous LN message is not complete (it is discarded by
+            // not committing it)
+            port->stats.truncatedMessages++;
+        }
+        // determine length of LN message: 2, 4, 6 or variable (0 = the
+        // length is given by the second byte)
+        port->rxParser.length = LN_OPCODE_LENGTH(lnRxData);
+        // reserve space in the LN RX queue (for a variable length message
+        // the first two bytes, the rest is reserved with the second byte)
+        port->rxParser.discard = !reserveMessage(&port->rxQueue,
+                (port->rxParser.length != 0) ? port->rxParser.length : 2);
+#if LN_RX_FILTER
+        // LN messages that are never queued don't need space
+        if ((lnRxDispatch[lnRxData & 0x7f].action & LN_RX_QUEUE) == 0)
+        {
+            port->rxParser.discard = true;
+        }
+#endif
+#if LN_RX_KEEP
+        port->rxParser.message[0] = lnRxData;
+#endif
+        if (!port->rxParser.discard)
+        {
+            writeMessageByte(&port->rxQueue, 0, lnRxData);
+        }
+        port->rxParser.count = 1;
+        port->rxParser.checksum = lnRxData;
+    }
+    else if (port->rxParser.count == 0)
+    {
+        // data byte outside of a LN message
+        port->stats.overrunBytes++;
     }
     else
     {
-        enQueue(&lnRxTempQueue, lnRxData);
-
-        // determine length of LN message
-        uint8_t lnMessageLength;
-        lnMessageLength = (lnRxTempQueue.values[lnRxTempQueue.head] & 0x60);
-        lnMessageLength = (lnMessageLength >> 4) + 2;
-        if (lnMessageLength > 6)
+        if (port->rxParser.length == 0)
+        {
+            // second byte of a variable length LN message
+            if (lnRxData < LN_VARIABLE_MIN_LENGTH)
+            {
+                port->stats.badLengths++;
+                port->rxParser.count = 0;
+                return;
+            }
+            port->rxParser.length = lnRxData;
+            port->rxParser.discard = port->rxParser.discard ||
+                    !reserveMessage(&port->rxQueue, port->rxParser.length);
+        }
+        if (!port->rxParser.discard)
+        {
+            writeMessageByte(&port->rxQueue, port->rxParser.count, lnRxData);
+        }
+#if LN_RX_KEEP
+        if (port->rxParser.count < LN_RX_KEEP)
         {
-            lnMessageLength = lnRxTempQueue.values[lnRxTempQueue.head + 1];
+            port->rxParser.message[port->rxParser.count] = lnRxData;
         }
+#endif
+        port->rxParser.count++;
+        port->rxParser.checksum ^= lnRxData;
 
         // has LN message reached the end the test checksum
-        if (lnMessageLength == lnRxTempQueue.numEntries)
+        if (port->rxParser.count == port->rxParser.length)
         {
-            if (isChecksumCorrect(&lnRxTempQueue))
+            port->rxParser.count = 0;
+#if LN_CACHE
+            if (port->rxParser.checksum == 0xff)
             {
-                // if checksum is correct then copy LN RX temp queue to
-                // LN RX queue
-                while (!isQueueEmpty(&lnRxTempQueue))
-                {
-                    enQueue(&lnRxQueue, lnRxTempQueue.values[lnRxTempQueue.head]);
-                    deQueue(&lnRxTempQueue);
-                }
+                // the caches follow every valid LN message (also the ones
+                // that are filtered out or dropped)
+                updateCaches(port, port->rxParser.message, port->rxParser.length);
+            }
+#endif
+            if (port->rxParser.checksum != 0xff)
+            {
+                port->stats.checksumErrors++;
+            }
+#if LN_RX_FILTER
+            else if ((dispatchRxMessage(port) & LN_RX_QUEUE) == 0)
+            {
+                // the LN message is not for the LN RX queue
+            }
+#endif
+            else if (port->rxParser.discard)
+            {
+                // the LN RX queue is full, the LN message is lost
+                port->stats.rxDropped++;
+            }
+            else
+            {
+                // if checksum is correct then publish the LN message
+                commitMessage(&port->rxQueue, port->rxParser.length);
+                port->stats.rxMessages++;
+                updateHighWater(&port->stats.rxHighWater, &port->rxQueue);
             }
         }
-    }     
+    }
 }
 
+#if LN_RX_FILTER
 /**
- * calculate the checksum
- * @param lnQueue: name of the queue (pass the address of the queue)
- * @return true: if checksum is correct 
+ * apply the dispatch table to a valid LN message (the handler of the opcode
+ * is called here if the address is in range)
+ * @return the actions for the LN message (LN_RX_DROP: the LN message is
+ * filtered out)
  */
-bool isChecksumCorrect(volatile lnQueue_t* lnQueue)
+uint8_t dispatchRxMessage(lnPort_t* port)
 {
-    uint8_t checksum = 0;    
-    for (uint8_t i = 0; i < lnQueue->numEntries; i++)
+    const lnRxDispatch_t* dispatch = &lnRxDispatch[port->rxParser.message[0] & 0x7f];
+    uint8_t action = dispatch->action;
+    if (action != LN_RX_DROP && dispatch->address != LN_ADDRESS_NONE)
     {
-        checksum ^= lnQueue->values[(lnQueue->head + i) % lnQueue->size];
-    }    
-    return (checksum == 0xff);
+        uint16_t address = getLnAddress(port->rxParser.message, dispatch->address);
+        if (address < dispatch->min || address > dispatch->max)
+        {
+            action = LN_RX_DROP;
+        }
+    }
+    if (action & LN_RX_HANDLER)
+    {
+        // the handler gets the bytes kept by the RX parser, so only the
+        // complete LN message (see LN_RX_HANDLER_LENGTH)
+        if (port->rxParser.length <= LN_RX_KEEP)
+        {
+            dispatch->handler(port, port->rxParser.message, port->rxParser.length);
+        }
+        else
+        {
+            port->stats.rxUnhandled++;
+        }
+    }
+    if (action == LN_RX_DROP)
+    {
+        port->stats.rxFiltered++;
+    }
+    return action;
+}
+#endif
+
+/**
+ * get the next LN message from the LN RX queue
+ * @param message: buffer for the LN message
+ * @param maxLength: the size of the buffer
+ * @return the length of the LN message (0: no message received), if the
+ * length is larger than maxLength the message is truncated
+ */
+uint8_t lnReceiveMessage(lnPort_t* port, uint8_t* message, uint8_t maxLength)
+{
+    uint8_t length = getMessageLength(&port->rxQueue);
+    for (uint8_t i = 0; i < length && i < maxLength; i++)
+    {
+        message[i] = getMessageByte(&port->rxQueue, i);
+    }
+    deQueueMessage(&port->rxQueue);
+    return length;
 }
 
 // </editor-fold>
 
 // <editor-fold defaultstate="collapsed" desc="TX routines">
 
+/**
+ * put a LN message on the LN TX queue of the normal priority class
+ * @param message: the bytes of the LN message (including the checksum)
+ * @param length: the length of the LN message
+ * @return true: if the message is queued, false: if the LN TX queue is full
+ */
+bool lnSendMessage(lnPort_t* port, const uint8_t* message, uint8_t length)
+{
+    return lnSendPriorityMessage(port, LN_PRIORITY_NORMAL, message, length);
+}
+
+/**
+ * put a LN message on the LN TX queue of a TX priority class
+ * @param priority: the TX priority class (LN_PRIORITY_HIGH, ...)
+ * @param message: the bytes of the LN message (including the checksum)
+ * @param length: the length of the LN message
+ * @return true: if the message is queued, false: if the LN TX queue is full
+ */
+bool lnSendPriorityMessage(lnPort_t* port, uint8_t priority, const uint8_t* message, uint8_t length)
+{
+    if (priority >= LN_TX_PRIORITIES)
+    {
+        return false;
+    }
+#if LN_TX_COALESCE
+    if (coalesceMessage(port, &port->txQueue[priority], message, length))
+    {
+        port->stats.txCoalesced++;
+        return true;
+    }
+#endif
+#if LN_OVERFLOW == LN_OVERFLOW_DROP_OLDEST
+    // make room by removing the oldest LN messages
+    while (!reserveMessage(&port->txQueue[priority], length) && evictMessage(port, priority))
+    {
+        port->stats.txEvicted++;
+    }
+#elif LN_OVERFLOW == LN_OVERFLOW_BLOCK
+    // wait until the ISR has transmitted enough LN messages
+    for (uint16_t i = 0; i < LN_OVERFLOW_TIMEOUT * 10u &&
+            !reserveMessage(&port->txQueue[priority], length); i++)
+    {
+        _delay(LN_OVERFLOW_POLL);
+    }
+#endif
+#if LN_LATENCY
+    // stamp the entry before the LN message is published to the ISR
+    port->txStamp[priority][port->txQueue[priority].msgTail] = port->hal->getTime(port);
+#endif
+#if LN_TX_BUDGET
+    // a coalesced LN message keeps the TX budget of the waiting one
+    port->txBudget[priority][port->txQueue[priority].msgTail] = port->txNextBudget;
+#endif
+    if (!enQueueMessage(&port->txQueue[priority], message, length))
+    {
+        port->stats.txDropped++;
+        return false;
+    }
+    updateHighWater(&port->stats.txHighWater[priority], &port->txQueue[priority]);
+#if LN_TICKLESS
+    wakeUpTmr1(port);
+#endif
+    return true;
+}
+
+/**
+ * put a LN message on the LN TX queue of a TX priority class, the length is
+ * given by the opcode or by the second byte (see ln_message.h)
+ * @param priority: the TX priority class (LN_PRIORITY_HIGH, ...)
+ * @param message: the bytes of the LN message (including the checksum)
+ * @return true: if the message is queued, false: if the LN TX queue is full
+ * or the length is invalid
+ */
+bool lnSendBuiltMessage(lnPort_t* port, uint8_t priority, const uint8_t* message)
+{
+    uint8_t length = LN_OPCODE_LENGTH(message[0]);
+    if (length == 0)
+    {
+        length = message[1];
+        if (length < LN_VARIABLE_MIN_LENGTH)
+        {
+            return false;
+        }
+    }
+    return lnSendPriorityMessage(port, priority, message, length);
+}
+
+#if LN_TX_BUDGET
+/**
+ * put a LN message with a TX budget on the LN TX queue of a TX priority class
+ * @param priority: the TX priority class (LN_PRIORITY_HIGH, ...)
+ * @param message: the bytes of the LN message (including the checksum)
+ * @param length: the length of the LN message
+ * @param attempts: the maximum number of attempts (LN_BUDGET_NONE: no limit)
+ * @param timeout: the deadline in units of 256s from now, at most 32767
+ * (LN_BUDGET_NONE: no deadline)
+ * @param tag: reported with the completion status (see lnGetTxStatus), 0:
+ * no completion status
+ * @return true: if the message is queued, false: if the LN TX queue is full
+ */
+bool lnSendBudgetMessage(lnPort_t* port, uint8_t priority, const uint8_t* message,
+        uint8_t length, uint8_t attempts, uint16_t timeout, uint8_t tag)
+{
+    port->txNextBudget.attempts = attempts;
+    port->txNextBudget.tag = tag;
+    port->txNextBudget.timed = (timeout != LN_BUDGET_NONE);
+    port->txNextBudget.deadline = port->hal->getTime(port) + timeout;
+    bool queued = lnSendPriorityMessage(port, priority, message, length);
+    memset(&port->txNextBudget, 0, sizeof(lnTxBudget_t));
+    return queued;
+}
+#endif
+
+#if LN_OVERFLOW == LN_OVERFLOW_DROP_OLDEST
+/**
+ * remove the oldest LN message of a LN TX queue (called by the main context,
+ * that is the consumer while the interrupts are disabled)
+ * @param priority: the TX priority class
+ * @return true: if a LN message is removed, false: if the LN TX queue is
+ * empty or its first LN message is in transmission
+ */
+bool evictMessage(lnPort_t* port, uint8_t priority)
+{
+    volatile lnMessageQueue_t* queue = &port->txQueue[priority];
+    bool evicted = false;
+    uint8_t isr = port->hal->lockIsr(port);
+    // the ISR transmits the first LN message from the synchronisation of
+    // the BRG until the last byte is verified
+    if (!isMessageQueueEmpty(queue) && !(port->LNCONbits.TX_PRIORITY == priority &&
+            (port->LNCONbits.TX_MODE || port->LNCONbits.TMR1_MODE == 3)))
+    {
+#if LN_TX_BUDGET
+        completeTxMessage(port, priority, queue->msgHead, LN_TX_EVICTED);
+#elif LN_LATENCY
+        port->txAttempts[priority] = 0;
+#endif
+        deQueueMessage(queue);
+        evicted = true;
+    }
+    port->hal->unlockIsr(port, isr);
+    return evicted;
+}
+#endif
+
+#if LN_TX_COALESCE
+/**
+ * replace a waiting LN message that is superseded by a new LN message (same
+ * opcode and address) in place
+ * @param queue: the LN TX queue of the TX priority class
+ * @param message: the bytes of the new LN message
+ * @param length: the length of the new LN message
+ * @return true: if a LN message is replaced, false: if the new LN message
+ * has to be appended
+ */
+bool coalesceMessage(lnPort_t* port, volatile lnMessageQueue_t* queue, const uint8_t* message,
+        uint8_t length)
+{
+    uint8_t format = getCoalesceFormat(message[0]);
+    if (format == LN_ADDRESS_NONE || length < 4)
+    {
+        return false;
+    }
+    uint16_t address = getLnAddress(message, format);
+
+    // the first LN message can be in transmission at any time, so the search
+    // starts with the second one (the ISR can remove the first LN message
+    // meanwhile, take a consistent copy of its position)
+    uint8_t isr = port->hal->lockIsr(port);
+    uint8_t msgHead = queue->msgHead;
+    uint8_t position = queue->bytes.head;
+    port->hal->unlockIsr(port, isr);
+    uint8_t msgTail = queue->msgTail;
+    if (msgHead == msgTail)
+    {
+        return false;
+    }
+    position += queue->lengths[msgHead];
+    msgHead = (msgHead + 1) & MESSAGE_QUEUE_MASK;
+    for (; msgHead != msgTail; msgHead = (msgHead + 1) & MESSAGE_QUEUE_MASK)
+    {
+        uint8_t queued[3];
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            queued[i] = queue->bytes.values[(position + i) & QUEUE_MASK];
+        }
+        if (queue->lengths[msgHead] == length && queued[0] == message[0] &&
+                getLnAddress(queued, format) == address &&
+                (format != LN_ADDRESS_SWITCH || ((queued[2] ^ message[2]) & 0x10) == 0))
+        {
+            // same opcode and address (for a switch also the same output
+            // on/off, so an on-off pulse is not lost), replace it if it is
+            // still waiting
+            bool replaced = false;
+            isr = port->hal->lockIsr(port);
+            uint8_t waiting = (msgTail - queue->msgHead) & MESSAGE_QUEUE_MASK;
+            uint8_t index = (msgHead - queue->msgHead) & MESSAGE_QUEUE_MASK;
+            if (index != 0 && index < waiting)
+            {
+                for (uint8_t i = 0; i < length; i++)
+                {
+                    queue->bytes.values[(position + i) & QUEUE_MASK] = message[i];
+                }
+                replaced = true;
+            }
+            port->hal->unlockIsr(port, isr);
+            return replaced;
+        }
+        position += queue->lengths[msgHead];
+    }
+    return false;
+}
+
+/**
+ * get the address format of the LN messages that can be coalesced
+ * @param opcode: the opcode of the LN message
+ * @return the address format, LN_ADDRESS_NONE: the LN message is never
+ * coalesced
+ */
+uint8_t getCoalesceFormat(uint8_t opcode)
+{
+    switch (opcode)
+    {
+        case 0xb0:                  // OPC_SW_REQ
+        case 0xbd:                  // OPC_SW_ACK
+            return LN_ADDRESS_SWITCH;
+        case 0xb2:                  // OPC_INPUT_REP
+            return LN_ADDRESS_SENSOR;
+        case 0xa0:                  // OPC_LOCO_SPD
+        case 0xa1:                  // OPC_LOCO_DIRF
+        case 0xa2:                  // OPC_LOCO_SND
+            return LN_ADDRESS_SLOT;
+        default:
+            return LN_ADDRESS_NONE;
+    }
+}
+#endif
+
+/**
+ * get the TX priority class of the next LN message to transmit
+ * @return the highest TX priority class with a LN message, or
+ * LN_TX_PRIORITIES if all LN TX queues are empty
+ */
+uint8_t getTxPriority(lnPort_t* port)
+{
+    uint8_t priority = 0;
+    while (priority < LN_TX_PRIORITIES && isMessageQueueEmpty(&port->txQueue[priority]))
+    {
+        priority++;
+    }
+    return priority;
+}
+
 /**
  * start routine for transmitting a LN message
- * @param the byte to transmit
+ * @param priority: the TX priority class of the LN message
  */
-void startTxLnMessage(void)
+void startTxLnMessage(lnPort_t* port, uint8_t priority)
 {
-    // first, copy next LN message from LN TX queue into LN TX temporary queue
-    do
+    // the LN message is transmitted directly from the LN TX queue, the
+    // cursor of the queue points to the next byte to transmit
+    port->LNCONbits.TX_PRIORITY = priority;
+#if LN_LATENCY || LN_TX_BUDGET
+    if (port->txAttempts[priority] < 0xff)
     {
-        enQueue(&lnTxTempQueue, lnTxQueue.values[lnTxQueue.head]);
-        deQueue(&lnTxQueue);
+        port->txAttempts[priority]++;
     }
-    while (!isQueueEmpty(&lnTxQueue) &&
-            ((lnTxQueue.values[lnTxQueue.head] & 0x80) != 0x80));
+#endif
     // sync BRG before transmitting the first data byte
-    startSyncBRG();            
+    startSyncBRG(port);            
 }
 
+#if LN_TX_BUDGET
+/**
+ * remove the first LN messages of the LN TX queues that are out of TX budget
+ * (ISR, no LN message in transmission)
+ */
+void expireTxMessages(lnPort_t* port)
+{
+    uint16_t now = port->hal->getTime(port);
+    for (uint8_t priority = 0; priority < LN_TX_PRIORITIES; priority++)
+    {
+        volatile lnMessageQueue_t* queue = &port->txQueue[priority];
+        while (!isMessageQueueEmpty(queue))
+        {
+            uint8_t msgHead = queue->msgHead;
+            volatile lnTxBudget_t* budget = &port->txBudget[priority][msgHead];
+            uint8_t status;
+            if (budget->attempts != LN_BUDGET_NONE &&
+                    port->txAttempts[priority] >= budget->attempts)
+            {
+                status = LN_TX_ATTEMPTS;
+            }
+            else if (budget->timed && (int16_t)(now - budget->deadline) >= 0)
+            {
+                status = LN_TX_DEADLINE;
+            }
+            else
+            {
+                break;
+            }
+            port->stats.txExpired++;
+            completeTxMessage(port, priority, msgHead, status);
+            deQueueMessage(queue);
+        }
+    }
+}
+
+/**
+ * end of the first LN message of a LN TX queue: reset its attempts and
+ * report the completion status if the LN message has a tag
+ * @param priority: the TX priority class of the LN message
+ * @param msgHead: the LN TX queue entry of the LN message
+ * @param status: the completion status (LN_TX_SENT, ...)
+ */
+void completeTxMessage(lnPort_t* port, uint8_t priority, uint8_t msgHead, uint8_t status)
+{
+    port->txAttempts[priority] = 0;
+    uint8_t tag = port->txBudget[priority][msgHead].tag;
+    if (tag == 0)
+    {
+        return;
+    }
+    volatile lnTxStatusRing_t* ring = &port->txStatus;
+    uint8_t tail = ring->tail;
+    uint8_t next = (tail + 1) & LN_TX_STATUS_MASK;
+    if (next == ring->head)
+    {
+        ring->lost++;
+        return;
+    }
+    ring->records[tail].tag = tag;
+    ring->records[tail].status = status;
+    // publish the record to the main context by moving the tail
+    ring->tail = next;
+}
+
+/**
+ * get the next completion status (called by the main context)
+ * @param tag: the tag of the LN message
+ * @param status: the completion status (LN_TX_SENT, LN_TX_ATTEMPTS,
+ * LN_TX_DEADLINE or LN_TX_EVICTED)
+ * @return true: if there is a completion status, false: if the status ring
+ * is empty
+ */
+bool lnGetTxStatus(lnPort_t* port, uint8_t* tag, uint8_t* status)
+{
+    uint8_t head = port->txStatus.head;
+    if (head == port->txStatus.tail)
+    {
+        return false;
+    }
+    *tag = port->txStatus.records[head].tag;
+    *status = port->txStatus.records[head].status;
+    // release the record to the ISR by moving the head
+    port->txStatus.head = (head + 1) & LN_TX_STATUS_MASK;
+    return true;
+}
+#endif
+
 /**
  * routine that handles the transmission of the message
  */
-void txHandler(void)
+void txHandler(lnPort_t* port)
 {
-    if (isLnFree())
+    if (isLnFree(port))
     {
         // the last transmited value (TXREG) must be stored (in lnTxData)
         // this is necessary to check if the data is transmitted correctly
         // (see routine rxHandler)
-        TXREG = lnTxTempQueue.values[lnTxTempQueue.head];
+        port->hal->writeTx(port,
+                getNextMessageByte(&port->txQueue[port->LNCONbits.TX_PRIORITY]));
+        port->LNCONbits.TX_MODE = 1;
+        // the echo is expected after 600s (10bits x 60s), timer 1 watches
+        // it (without a restart timer 1 would overflow during a LN message
+        // of more than 65ms and start the LN message again)
+        port->hal->startTimer(port, 2000u);
     }
     else
     {
         // if line is not free start the linebreak
-        startLinebreak(900u);
+        port->stats.collisions++;
+        startLinebreak(port, 900u);
     }
 }
 
 // </editor-fold>
 
+// <editor-fold defaultstate="collapsed" desc="statistics">
+
+/**
+ * update the high-water mark of a queue
+ * @param highWater: the high-water mark (in bytes)
+ * @param queue: name of the queue (pass the address of the queue)
+ */
+void updateHighWater(volatile uint8_t* highWater, volatile lnMessageQueue_t* queue)
+{
+    uint8_t numEntries = getNumEntries(&queue->bytes);
+    if (numEntries > *highWater)
+    {
+        *highWater = numEntries;
+    }
+}
+
+/**
+ * take a consistent snapshot of the driver statistics
+ * @param stats: buffer for the snapshot
+ * @param reset: true: reset the statistics (in the same atomic step)
+ */
+void lnGetStats(lnPort_t* port, lnStats_t* stats, bool reset)
+{
+    uint8_t isr = port->hal->lockIsr(port);
+    memcpy(stats, (const void*)&port->stats, sizeof(lnStats_t));
+    if (reset)
+    {
+        memset((void*)&port->stats, 0, sizeof(lnStats_t));
+    }
+    port->hal->unlockIsr(port, isr);
+}
+
+#if LN_LATENCY
+/**
+ * add a transmitted LN message to the latency histograms
+ * @param priority: the TX priority class of the LN message
+ * @param msgHead: the LN TX queue entry of the LN message
+ */
+void updateLatency(lnPort_t* port, uint8_t priority, uint8_t msgHead)
+{
+    uint16_t latency = port->hal->getTime(port) - port->txStamp[priority][msgHead];
+    uint8_t bucket = 0;
+    while (latency > 1 && bucket < LN_LATENCY_BUCKETS - 1)
+    {
+        latency >>= 1;
+        bucket++;
+    }
+    port->latency.latency[priority][bucket]++;
+    uint8_t attempts = port->txAttempts[priority];
+    if (attempts > LN_LATENCY_ATTEMPTS)
+    {
+        attempts = LN_LATENCY_ATTEMPTS;
+    }
+    port->latency.attempts[attempts - 1]++;
+    port->txAttempts[priority] = 0;
+}
+
+/**
+ * take a consistent snapshot of the latency histograms
+ * @param latency: buffer for the snapshot
+ * @param reset: true: reset the histograms (in the same atomic step)
+ */
+void lnGetLatency(lnPort_t* port, lnLatency_t* latency, bool reset)
+{
+    uint8_t isr = port->hal->lockIsr(port);
+    memcpy(latency, (const void*)&port->latency, sizeof(lnLatency_t));
+    if (reset)
+    {
+        memset((void*)&port->latency, 0, sizeof(lnLatency_t));
+    }
+    port->hal->unlockIsr(port, isr);
+}
+#endif
+
+#if LN_BUS_LOAD
+/**
+ * close the intervals of the bus load estimator that are over and refill
+ * the token bucket (ISR)
+ */
+void updateBusLoad(lnPort_t* port)
+{
+    volatile lnBusLoad_t* busLoad = &port->busLoad;
+    uint16_t intervals = (uint16_t)(port->hal->getTime(port) - busLoad->start) / LN_LOAD_INTERVAL;
+    if (intervals == 0)
+    {
+        return;
+    }
+    busLoad->start += intervals * LN_LOAD_INTERVAL;
+#if LN_TX_LIMIT
+    uint16_t tokens = busLoad->tokens + intervals * busLoad->rate;
+    busLoad->tokens = (tokens < busLoad->burst) ? (uint8_t)tokens : busLoad->burst;
+#endif
+    // the current interval is complete, the next ones (if any) were empty
+    if (intervals > LN_LOAD_WINDOW)
+    {
+        intervals = LN_LOAD_WINDOW;
+    }
+    do
+    {
+        uint8_t index = busLoad->index;
+        busLoad->sum = busLoad->sum - busLoad->bytes[index] + busLoad->current;
+        busLoad->bytes[index] = busLoad->current;
+        busLoad->index = (index + 1) & LN_LOAD_MASK;
+        busLoad->current = 0;
+    }
+    while (--intervals != 0);
+    // load = sum x 600s / (window x 65536s) in %
+    uint16_t load = (uint16_t)(((uint32_t)busLoad->sum * 1875u) / (LN_LOAD_WINDOW * 2048u));
+    busLoad->load = (load < 100u) ? (uint8_t)load : 100u;
+}
+
+/**
+ * get the bus load, the moving average over the last LN_LOAD_WINDOW
+ * intervals of 65.5ms
+ * @return the bus load in %
+ */
+uint8_t lnGetBusLoad(lnPort_t* port)
+{
+    uint8_t isr = port->hal->lockIsr(port);
+    updateBusLoad(port);
+    uint8_t load = port->busLoad.load;
+    port->hal->unlockIsr(port, isr);
+    return load;
+}
+#endif
+
+#if LN_TX_LIMIT
+/**
+ * check if the first LN message of a LN TX queue is held back by the TX
+ * limiter (ISR)
+ * @param priority: the TX priority class of the LN message
+ * @return true: if the LN message has to wait for tokens
+ */
+bool isTxLimited(lnPort_t* port, uint8_t priority)
+{
+    volatile lnBusLoad_t* busLoad = &port->busLoad;
+    if (priority == LN_PRIORITY_HIGH || busLoad->threshold == 0)
+    {
+        return false;
+    }
+    updateBusLoad(port);
+    // a LN message larger than the bucket only waits for a full bucket
+    uint8_t length = getMessageLength(&port->txQueue[priority]);
+    return (busLoad->load >= busLoad->threshold &&
+            busLoad->tokens < length && busLoad->tokens < busLoad->burst);
+}
+
+/**
+ * take the tokens of a transmitted LN message from the token bucket (ISR)
+ * @param priority: the TX priority class of the LN message
+ * @param length: the length of the LN message
+ */
+void takeTxTokens(lnPort_t* port, uint8_t priority, uint8_t length)
+{
+    if (priority != LN_PRIORITY_HIGH)
+    {
+        uint8_t tokens = port->busLoad.tokens;
+        port->busLoad.tokens = (tokens > length) ? tokens - length : 0;
+    }
+}
+
+/**
+ * set the TX limiter
+ * @param threshold: the bus load in % from which the normal and low TX
+ * priority classes are limited (0: no limit)
+ * @param rate: the rate of the tokens in % of the bus capacity (at most 100)
+ * @param burst: the size of the token bucket in bytes
+ */
+void lnSetTxLimit(lnPort_t* port, uint8_t threshold, uint8_t rate, uint8_t burst)
+{
+    if (rate > 100u)
+    {
+        rate = 100u;
+    }
+    uint8_t isr = port->hal->lockIsr(port);
+    port->busLoad.threshold = threshold;
+    port->busLoad.rate = (uint8_t)(((uint16_t)rate * LN_LOAD_FULL) / 100u);
+    port->busLoad.burst = burst;
+    port->busLoad.tokens = burst;
+    port->hal->unlockIsr(port, isr);
+}
+#endif
+
+#if LN_TRACE
+/**
+ * get the records of the trace ring (called by the main context)
+ * @param records: buffer for the records
+ * @param maxRecords: the size of the buffer
+ * @return the number of records
+ */
+uint8_t lnReadTrace(lnPort_t* port, lnTraceRecord_t* records, uint8_t maxRecords)
+{
+    uint8_t count = 0;
+    uint8_t head = port->trace.head;
+    while (count < maxRecords && head != port->trace.tail)
+    {
+        records[count++] = port->trace.records[head];
+        head = (head + 1) & LN_TRACE_MASK;
+    }
+    // release the records to the top half by moving the head
+    port->trace.head = head;
+    return count;
+}
+#endif
+
+// </editor-fold>
+
+#if LN_CACHE
+// <editor-fold defaultstate="collapsed" desc="caches">
+
+/**
+ * update the caches with a valid LN message (ISR)
+ * @param message: the first LN_RX_KEEP bytes of the LN message
+ * @param length: the length of the LN message
+ */
+void updateCaches(lnPort_t* port, const uint8_t* message, uint8_t length)
+{
+#if LN_SLOT_CACHE
+    updateSlotCache(port, message, length);
+#endif
+#if LN_STATE_CACHE
+    updateStateCache(port, message, length);
+#endif
+}
+
+/**
+ * update the caches with the LN message in transmission, its last byte is
+ * echoed (ISR)
+ * @param txQueue: the LN TX queue of the LN message
+ */
+void cacheTxMessage(lnPort_t* port, volatile lnMessageQueue_t* txQueue)
+{
+    uint8_t message[LN_RX_KEEP] = { 0 };
+    uint8_t length = getMessageLength(txQueue);
+    for (uint8_t i = 0; i < length && i < LN_RX_KEEP; i++)
+    {
+        message[i] = getMessageByte(txQueue, i);
+    }
+    updateCaches(port, message, length);
+}
+
+// </editor-fold>
+#endif
+
+#if LN_SLOT_CACHE
+// <editor-fold defaultstate="collapsed" desc="slot cache">
+
+/**
+ * update the slot cache with a valid LN message (ISR)
+ * @param message: the first LN_SLOT_COPY bytes of the LN message
+ * @param length: the length of the LN message
+ */
+void updateSlotCache(lnPort_t* port, const uint8_t* message, uint8_t length)
+{
+    volatile lnSlot_t* slot;
+
+    switch (message[0])
+    {
+        case 0xe7:                  // OPC_SL_RD_DATA
+        case 0xef:                  // OPC_WR_SL_DATA
+            // the complete state of the slot (in byte 2)
+            if (length == 14 && message[2] < LN_SLOTS)
+            {
+                slot = &port->slots[message[2]];
+                slot->stat1 = message[3];
+                slot->address = message[4];
+                slot->speed = message[5];
+                slot->dirf = message[6];
+                slot->address2 = message[9];
+                slot->sound = message[10];
+                slot->age = 0;
+            }
+            return;
+        case 0xba:                  // OPC_MOVE_SLOTS
+            // the result is only known from the answer of the command
+            // station (OPC_SL_RD_DATA of the destination slot or
+            // OPC_LONG_ACK), forget both slots
+            if (message[1] < LN_SLOTS)
+            {
+                port->slots[message[1]].age = LN_SLOT_UNKNOWN;
+            }
+            if (message[2] < LN_SLOTS)
+            {
+                port->slots[message[2]].age = LN_SLOT_UNKNOWN;
+            }
+            return;
+        default:
+            break;
+    }
+
+    // a single field of a slot (in byte 1) with a known state
+    if (length != 4 || message[1] >= LN_SLOTS)
+    {
+        return;
+    }
+    slot = &port->slots[message[1]];
+    if (slot->age == LN_SLOT_UNKNOWN)
+    {
+        return;
+    }
+    switch (message[0])
+    {
+        case 0xa0:                  // OPC_LOCO_SPD
+            slot->speed = message[2];
+            break;
+        case 0xa1:                  // OPC_LOCO_DIRF
+            slot->dirf = message[2];
+            break;
+        case 0xa2:                  // OPC_LOCO_SND
+            slot->sound = message[2];
+            break;
+        case 0xb5:                  // OPC_SLOT_STAT1
+            slot->stat1 = message[2];
+            break;
+        default:
+            return;
+    }
+    slot->age = 0;
+}
+
+/**
+ * get the last known state of a slot (called by the main context), request
+ * the slot (OPC_RQ_SL_DATA) only if the state is not known or too old
+ * @param slot: the slot (0 ... LN_SLOTS - 1)
+ * @param maxAge: the maximum age (lnAgeSlots calls since the last update)
+ * @param state: buffer for the state of the slot
+ * @return true: if the state is known and not older than maxAge
+ */
+bool lnGetSlot(lnPort_t* port, uint8_t slot, uint8_t maxAge, lnSlot_t* state)
+{
+    if (slot >= LN_SLOTS)
+    {
+        return false;
+    }
+    uint8_t isr = port->hal->lockIsr(port);
+    memcpy(state, (const void*)&port->slots[slot], sizeof(lnSlot_t));
+    port->hal->unlockIsr(port, isr);
+    return (state->age != LN_SLOT_UNKNOWN && state->age <= maxAge);
+}
+
+/**
+ * age the slot cache (called by the main context at a fixed interval, eg.
+ * every second), the age of a slot saturates at LN_SLOT_AGE_MAX
+ */
+void lnAgeSlots(lnPort_t* port)
+{
+    for (uint8_t i = 0; i < LN_SLOTS; i++)
+    {
+        // the ISR can reset the age meanwhile
+        uint8_t isr = port->hal->lockIsr(port);
+        if (port->slots[i].age < LN_SLOT_AGE_MAX)
+        {
+            port->slots[i].age++;
+        }
+        port->hal->unlockIsr(port, isr);
+    }
+}
+
+// </editor-fold>
+#endif
+
+#if LN_STATE_CACHE
+// <editor-fold defaultstate="collapsed" desc="state cache">
+
+/**
+ * update the state cache with a valid LN message (ISR)
+ * @param message: the first 4 bytes of the LN message
+ * @param length: the length of the LN message
+ */
+void updateStateCache(lnPort_t* port, const uint8_t* message, uint8_t length)
+{
+    if (length != 4)
+    {
+        return;
+    }
+    switch (message[0])
+    {
+        case 0xb2:                  // OPC_INPUT_REP: L (bit 4 of byte 2)
+            setCachedState(port, getLnAddress(message, LN_ADDRESS_SENSOR),
+                    (message[2] & 0x10) != 0);
+            break;
+        case 0xb0:                  // OPC_SW_REQ: DIR (bit 5 of byte 2)
+        case 0xbd:                  // OPC_SW_ACK
+            setCachedState(port, LN_SENSORS + getLnAddress(message, LN_ADDRESS_SWITCH),
+                    (message[2] & 0x20) != 0);
+            break;
+        case 0xb1:                  // OPC_SW_REP
+            // only an output report (bit 6 = 0) with C (bit 5) or T (bit 4)
+            if ((message[2] & 0x40) == 0 && (message[2] & 0x30) != 0)
+            {
+                setCachedState(port, LN_SENSORS + getLnAddress(message, LN_ADDRESS_SWITCH),
+                        (message[2] & 0x20) != 0);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * set a bit of the state cache, a change sets its dirty bit (ISR)
+ * @param index: the bit (sensor address or LN_SENSORS + switch address)
+ * @param state: the new state
+ */
+void setCachedState(lnPort_t* port, uint16_t index, bool state)
+{
+    volatile lnStateCache_t* cache = &port->stateCache;
+    uint16_t byte = index >> 3;
+    uint8_t mask = (uint8_t)(1u << (index & 7));
+    if (((cache->state[byte] & mask) != 0) == state)
+    {
+        return;
+    }
+    cache->state[byte] ^= mask;
+    if ((cache->dirty[byte] & mask) == 0)
+    {
+        cache->dirty[byte] |= mask;
+        cache->summary[byte >> 3] |= (uint8_t)(1u << (byte & 7));
+        cache->changes++;
+    }
+}
+
+/**
+ * get the next changed sensor or switch and clear its dirty bit (called by
+ * the main context), the cost does not depend on the LN traffic: nothing to
+ * do without changes, else a scan of the summary (LN_STATE_SUMMARY bytes)
+ * @param address: the address of the sensor (0 ... 4095) or of the switch
+ * (0 ... 2047)
+ * @param state: the current state
+ * @return LN_STATE_SENSOR, LN_STATE_SWITCH or LN_STATE_NONE (no change)
+ */
+uint8_t lnGetStateChange(lnPort_t* port, uint16_t* address, bool* state)
+{
+    volatile lnStateCache_t* cache = &port->stateCache;
+    uint8_t isr = port->hal->lockIsr(port);
+    uint16_t changes = cache->changes;
+    port->hal->unlockIsr(port, isr);
+    if (changes == 0)
+    {
+        return LN_STATE_NONE;
+    }
+
+    uint8_t i = 0;
+    while (cache->summary[i] == 0)
+    {
+        i++;
+    }
+    uint8_t j = 0;
+    while ((cache->summary[i] & (1u << j)) == 0)
+    {
+        j++;
+    }
+    uint16_t byte = ((uint16_t)i << 3) + j;
+    uint8_t bit = 0;
+    while ((cache->dirty[byte] & (1u << bit)) == 0)
+    {
+        bit++;
+    }
+    uint8_t mask = (uint8_t)(1u << bit);
+
+    // the ISR can change the bitmaps meanwhile
+    isr = port->hal->lockIsr(port);
+    cache->dirty[byte] &= (uint8_t)~mask;
+    if (cache->dirty[byte] == 0)
+    {
+        cache->summary[i] &= (uint8_t)~(1u << j);
+    }
+    cache->changes--;
+    *state = (cache->state[byte] & mask) != 0;
+    port->hal->unlockIsr(port, isr);
+
+    uint16_t index = (byte << 3) + bit;
+    if (index < LN_SENSORS)
+    {
+        *address = index;
+        return LN_STATE_SENSOR;
+    }
+    *address = index - LN_SENSORS;
+    return LN_STATE_SWITCH;
+}
+
+/**
+ * get the state of a sensor
+ * @param address: the address of the sensor (0 ... 4095)
+ * @return true: if the sensor is occupied, false: if the sensor is free or
+ * the address is out of range
+ */
+bool lnGetSensor(lnPort_t* port, uint16_t address)
+{
+    if (address >= LN_SENSORS)
+    {
+        return false;
+    }
+    return (port->stateCache.state[address >> 3] & (1u << (address & 7))) != 0;
+}
+
+/**
+ * get the state of a switch
+ * @param address: the address of the switch (0 ... 2047)
+ * @return true: if the switch is closed, false: if the switch is thrown or
+ * the address is out of range
+ */
+bool lnGetSwitch(lnPort_t* port, uint16_t address)
+{
+    if (address >= LN_SWITCHES)
+    {
+        return false;
+    }
+    uint16_t index = LN_SENSORS + address;
+    return (port->stateCache.state[index >> 3] & (1u << (index & 7))) != 0;
+}
+
+// </editor-fold>
+#endif
+
 // <editor-fold defaultstate="collapsed" desc="LN routines">
 
 /**
  * check if the LocoNet is free (to use)
  * @return true: if the line is free, false: if the line is occupied
  */
-bool isLnFree(void)
+bool isLnFree(lnPort_t* port)
 {
     // check if:
     //  RC7 = 1 (PORT C, bit 7 = high)
     //  RCIDL = 1 (receiver is idle = no data reception in progress)
-    return (PORTCbits.RC7 && BAUDCONbits.RCIDL);
+    return port->hal->isLineFree(port);
 }
+
+#if LN_RX_FILTER || LN_TX_COALESCE || LN_STATE_CACHE
+/**
+ * decode the address of a LN message
+ * @param message: the bytes of the LN message (at least 3)
+ * @param format: the address format (LN_ADDRESS_SWITCH, ...)
+ * @return the address
+ */
+uint16_t getLnAddress(const uint8_t* message, uint8_t format)
+{
+    switch (format)
+    {
+        case LN_ADDRESS_SWITCH:
+            // A6 ... A0 in byte 1, A10 ... A7 in byte 2
+            return ((uint16_t)(message[2] & 0x0f) << 7) | message[1];
+        case LN_ADDRESS_SENSOR:
+            // the switch address and the I bit (bit 5 of byte 2) as lsb
+            return ((((uint16_t)(message[2] & 0x0f) << 7) | message[1]) << 1) |
+                    ((message[2] >> 5) & 1u);
+        case LN_ADDRESS_SLOT:
+            return message[1];
+        case LN_ADDRESS_SLOT_DATA:
+            return message[2];
+        default:
+            return 0;
+    }
+}
+#endif
 // </editor-fold>
 
 // <editor-fold defaultstate="collapsed" desc="Timer 1 routines">
 
-void startIdleDelay(void)
+void startIdleDelay(lnPort_t* port)
 {
     // delay = 1000s
-    WRITETIMER1(~1000);             // set delay in timer 1
-    LNCONbits.TMR1_MODE = 0;        // 0: timer 0 in idle mode    
-    // in idle mode, the led 'data on LN' can be turned off (active low)
-    LATAbits.LATA5 = 1;
+    port->hal->startTimer(port, 1000u); // set delay in timer 1
+    port->LNCONbits.TMR1_MODE = 0;  // 0: timer 0 in idle mode    
+    // in idle mode, the led 'data on LN' can be turned off
+    port->hal->setLed(port, false);
 }
 
+#if LN_TICKLESS
+/**
+ * stop timer 1 (tickless idle), LN was free for at least the CMP delay and
+ * every received byte restarts the CMP delay
+ */
+void stopTmr1(lnPort_t* port)
+{
+    port->hal->stopTimer(port);     // disable timer 1
+    port->LNCONbits.TMR1_MODE = 0;  // 0: timer 1 in idle mode
+    // in idle mode, the led 'data on LN' can be turned off
+    port->hal->setLed(port, false);
+}
+
+/**
+ * restart a stopped timer 1 for a new LN message (called by the main context)
+ */
+void wakeUpTmr1(lnPort_t* port)
+{
+    // the CMP delay is already over: let the timer 1 interrupt (idle mode)
+    // start the transmission right away
+    uint8_t isr = port->hal->lockIsr(port);
+    port->hal->wakeTimer(port);
+    port->hal->unlockIsr(port, isr);
+}
+#endif
+
 /**
  * start the carrier + master + priority delay
  */
-void startCmpDelay(void)
+void startCmpDelay(lnPort_t* port)
 {
-    // delay CMP = 1200s + 360s + random (between 0s and 1023s)
-    uint16_t delay = getRandomValue(lastRandomValue);
-    lastRandomValue = delay;        // store last value of random generator
-    delay &= 1023u;                 // get random value between 0 and 1023
+    // delay CMP = 1200s + 360s + priority delay
+    // the priority delay is a random value in the window of the TX priority
+    // class of the next LN message (the normal class if nothing is queued)
+    uint8_t priority = getTxPriority(port);
+    if (priority >= LN_TX_PRIORITIES)
+    {
+        priority = LN_PRIORITY_NORMAL;
+    }
+    uint16_t mask = lnPriorityDelay[priority].mask;
+#if LN_BACKOFF == LN_BACKOFF_ADAPTIVE
+    // widen the random window after collisions and linebreaks
+    mask = (mask << port->LNCONbits.BACKOFF) | ((1u << port->LNCONbits.BACKOFF) - 1u);
+#endif
+    uint16_t delay = getRandomValue(port->lastRandomValue);
+    port->lastRandomValue = delay;        // store last value of random generator
+    delay &= mask;                  // get random priority delay
+    delay += lnPriorityDelay[priority].offset;
     delay += 1560u;                 // add C + M delay (= 1560s)
-    WRITETIMER1(~delay);            // set delay in timer 1
-    LNCONbits.TMR1_MODE = 1;        // 1: timer 1 in CMP delay mode
-    // led 'data on LN' on (active low)
-    LATAbits.LATA5 = 0;
+    port->hal->startTimer(port, delay); // set delay in timer 1
+    port->LNCONbits.TMR1_MODE = 1;  // 1: timer 1 in CMP delay mode
+    // led 'data on LN' on
+    port->hal->setLed(port, true);
 }
 
 /**
@@ -421,14 +1588,25 @@ uint16_t getRandomValue(uint16_t lfsr)
  * @param the time of the linebreak
  * @return 
  */
-void startLinebreak(uint16_t time)
+void startLinebreak(lnPort_t* port, uint16_t time)
 {
-    // linebreak detect by framing error
-    RCSTAbits.SPEN = false;         // stop EUSART
-    PORTCbits.RC6 = true;
+    // a linebreak aborts the LN message in transmission, rewind the cursor
+    // so the LN message is retransmitted from the start
+    recoverLnMessage(&port->txQueue[port->LNCONbits.TX_PRIORITY]);
+    port->LNCONbits.TX_MODE = 0;
+    // count the linebreaks while a LN message is waiting (adaptive backoff)
+    if (port->LNCONbits.BACKOFF < LN_BACKOFF_LIMIT && getTxPriority(port) < LN_TX_PRIORITIES)
+    {
+        port->LNCONbits.BACKOFF++;
+    }
+    // linebreak detect by framing error (stop EUSART, LN output low)
+    port->hal->setLinebreak(port, true);
+    // stopping the EUSART clears its receive FIFO, the bytes in the raw ring
+    // are from before the linebreak as well
+    port->rawRing.head = port->rawRing.tail;
     // a LN linebreak definition 
-    WRITETIMER1(~time);
-    LNCONbits.TMR1_MODE = 2;        // 2: timer 1 in linebreak mode
+    port->hal->startTimer(port, time);
+    port->LNCONbits.TMR1_MODE = 2;  // 2: timer 1 in linebreak mode
 }
 
 // </editor-fold>
@@ -438,7 +1616,7 @@ void startLinebreak(uint16_t time)
 /**
  * routine to synchronize the BRG
  */
-void startSyncBRG(void)
+void startSyncBRG(lnPort_t* port)
 {
     // this routine handles the synchronisation of the BRG
     // it is important that the transmission of the message could be started
@@ -448,18 +1626,9 @@ void startSyncBRG(void)
     // whether the line is still free
     // to make this possible restart the BRG and start a delay of
     // approximately 60s
-    setBRG();
-    WRITETIMER1(~60);        // set delay approxity 60s (= 1 bit) in timer 1
-    LNCONbits.TMR1_MODE = 3; // set timer 1 mode in synchronisation BRG
-}
-
-/**
- * sets and initialise the value of the bautrate generator
- */
-void setBRG(void)
-{
-    SPBRGH = 0;                 // baudrate = 16.666
-    SPBRG = 119u;               // ((32.000.000 / 16.666) / 16) - 1 = 119 (0x77)
+    port->hal->setBRG(port);
+    port->hal->startTimer(port, 60u);   // set delay approxity 60s (= 1 bit)
+    port->LNCONbits.TMR1_MODE = 3; // set timer 1 mode in synchronisation BRG
 }
 
 // </editor-fold>
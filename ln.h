@@ -5,6 +5,8 @@
  *
  * revision history:
  *  v1.0 Creation (14/01/2024 15:28)
+ *  v1.1 driver state in a port context (lnPort_t) with hardware hooks
+ *       (16/10/2026)
  */
 
 // this is a guard condition so that contents of this file are not included
@@ -15,36 +17,153 @@
 #include <xc.h> // include processor files - each processor file is guarded. 
 #include <stdbool.h>
 #include <stdint.h>
-#include "config.h"
 #include "circular_queue.h"
 
-void lnInit(void);
-void lnInitComparator(void);
-void lnInitEusart(void);
-void lnInitTmr1(void);
-void lnInitIsr(void);
-void lnInitLeds(void);
+// the driver state of one LN port, every routine of the driver gets the port
+// as first parameter, so more ports (eg. simulated nodes) can be driven
+typedef struct lnPort_t lnPort_t;
 
-void lnIsr(void);
-void lnIsrTmr1(void);
-void lnIsrRcError(void);
-void lnIsrRc(void);
+// length of a LN message from the opcode (bits 6 ... 5): 2, 4, 6 or 0 (the
+// length is given by the second byte, at least LN_VARIABLE_MIN_LENGTH)
+#define LN_OPCODE_LENGTH(opcode) ((((opcode) & 0x60) == 0x60) ? 0u : \
+        ((((opcode) & 0x60) >> 4) + 2u))
+#define LN_VARIABLE_MIN_LENGTH 3u
 
-void rxHandler(uint8_t);
+// TX priority classes, every class has its own LN TX queue and its own
+// priority delay (part of the CMP delay, see startCmpDelay)
+#define LN_PRIORITY_HIGH 0          // eg. stop and turnout commands
+#define LN_PRIORITY_NORMAL 1
+#define LN_PRIORITY_LOW 2           // eg. sensor reports
+#define LN_TX_PRIORITIES 3
 
-void startTxLnMessage(void);
-void txHandler(void);
-bool isChecksumCorrect(volatile lnQueue_t*);
+// backoff policy of the priority delay (see startCmpDelay)
+//  LN_BACKOFF_FIXED: random window of the TX priority class
+//  LN_BACKOFF_ADAPTIVE: the random window is doubled for every linebreak
+//  since the last successful transmission (up to LN_BACKOFF_LIMIT times)
+#define LN_BACKOFF_FIXED 0
+#define LN_BACKOFF_ADAPTIVE 1
+#ifndef LN_BACKOFF
+#define LN_BACKOFF LN_BACKOFF_FIXED
+#endif
+#define LN_BACKOFF_LIMIT 3
 
-bool isLnFree(void);
+// tickless idle: with LN_TICKLESS set to 1 timer 1 is stopped when LN is
+// free and nothing has to be transmitted (instead of polling every 1000s),
+// received data restarts it with the CMP delay and lnSendPriorityMessage
+// restarts it for the new LN message (off by default, the firmware keeps
+// polling)
+#ifndef LN_TICKLESS
+#define LN_TICKLESS 0
+#endif
 
-void startIdleDelay(void);
-void startCmpDelay(void);
-void startLinebreak(uint16_t);
-void startSyncBRG(void);
-void setBRG(void);
+// overflow policy of the LN TX queues (see lnSendPriorityMessage), a LN
+// message is always queued completely or not at all
+//  LN_OVERFLOW_DROP_NEWEST: the new LN message is refused
+//  LN_OVERFLOW_DROP_OLDEST: the oldest LN messages are removed to make room
+//  (not the LN message in transmission)
+//  LN_OVERFLOW_BLOCK: wait (main context) until the ISR has made room, the
+//  new LN message is refused after LN_OVERFLOW_TIMEOUT ms
+#define LN_OVERFLOW_DROP_NEWEST 0
+#define LN_OVERFLOW_DROP_OLDEST 1
+#define LN_OVERFLOW_BLOCK 2
+#ifndef LN_OVERFLOW
+#define LN_OVERFLOW LN_OVERFLOW_DROP_NEWEST
+#endif
+#define LN_OVERFLOW_TIMEOUT 50u
+#define LN_OVERFLOW_POLL 800u       // 100s (instruction cycles of 125ns)
 
-uint16_t getRandomValue(uint16_t);
+// RX dispatch: with LN_RX_FILTER set to 1 a valid LN message is only queued
+// (and/or handed to a handler) if its opcode is in the dispatch table
+// lnRxDispatch (see ln_dispatch.h and ln_dispatch.c) and its address is in
+// the range of the opcode, all other LN messages are dropped by the ISR
+#ifndef LN_RX_FILTER
+#define LN_RX_FILTER 0
+#endif
+#define LN_RX_DROP 0x00             // drop the LN message
+#define LN_RX_QUEUE 0x01            // put the LN message on the LN RX queue
+#define LN_RX_HANDLER 0x02          // call the handler (in the ISR)
+#define LN_RX_COPY 6                // bytes kept by the RX parser
+// longest LN message handed to a handler (the RX parser keeps this many
+// bytes), a longer LN message is not handed to the handler and counted in
+// rxUnhandled (set it to 127 for handlers of any LN message)
+#ifndef LN_RX_HANDLER_LENGTH
+#define LN_RX_HANDLER_LENGTH LN_RX_COPY
+#endif
+#if LN_RX_HANDLER_LENGTH < 2 || LN_RX_HANDLER_LENGTH > 127
+#error "LN_RX_HANDLER_LENGTH must be 2 ... 127"
+#endif
+
+// coalescing: with LN_TX_COALESCE set to 1 a new LN message replaces a
+// waiting LN message with the same opcode and address in the LN TX queue
+// (see getCoalesceFormat) instead of being appended
+#ifndef LN_TX_COALESCE
+#define LN_TX_COALESCE 0
+#endif
+
+// address formats of the address filter and of the coalescing
+#define LN_ADDRESS_NONE 0           // no address filter
+#define LN_ADDRESS_SWITCH 1         // OPC_SW_REQ, ...: 0 ... 2047
+#define LN_ADDRESS_SENSOR 2         // OPC_INPUT_REP: 0 ... 4095
+#define LN_ADDRESS_SLOT 3           // OPC_LOCO_SPD, ...: slot in byte 1
+#define LN_ADDRESS_SLOT_DATA 4      // OPC_SL_RD_DATA, ...: slot in byte 2
+
+// slot cache: with LN_SLOT_CACHE set to 1 the driver keeps the last known
+// state of the slots 0 ... LN_SLOTS - 1, updated by the ISR from the valid LN
+// messages on LN (also the transmitted ones): OPC_SL_RD_DATA, OPC_WR_SL_DATA,
+// OPC_LOCO_SPD, OPC_LOCO_DIRF, OPC_LOCO_SND, OPC_SLOT_STAT1 and
+// OPC_MOVE_SLOTS (see lnGetSlot and lnAgeSlots)
+#ifndef LN_SLOT_CACHE
+#define LN_SLOT_CACHE 0
+#endif
+#define LN_SLOTS 120u
+#define LN_SLOT_COPY 11             // bytes of OPC_SL_RD_DATA up to SND
+#define LN_SLOT_UNKNOWN 0xff        // age of a slot without a known state
+#define LN_SLOT_AGE_MAX 0xfe
+
+// state cache: with LN_STATE_CACHE set to 1 the driver keeps the state of
+// the sensors (OPC_INPUT_REP) and of the switches (OPC_SW_REQ, OPC_SW_ACK and
+// the output reports of OPC_SW_REP) in bitmaps, updated by the ISR. Every
+// change sets a dirty bit, a summary bit per dirty byte and a counter lead
+// the application to the changed addresses (see lnGetStateChange)
+#ifndef LN_STATE_CACHE
+#define LN_STATE_CACHE 0
+#endif
+#define LN_SENSORS 4096u            // bits 0 ... 4095 of the bitmaps
+#define LN_SWITCHES 2048u           // bits 4096 ... 6143 of the bitmaps
+#define LN_STATE_BYTES ((LN_SENSORS + LN_SWITCHES) / 8u)
+#define LN_STATE_SUMMARY (LN_STATE_BYTES / 8u)
+#define LN_STATE_NONE 0             // kinds of a state change
+#define LN_STATE_SENSOR 1
+#define LN_STATE_SWITCH 2
+
+// the caches follow the LN messages on LN
+#define LN_CACHE (LN_SLOT_CACHE || LN_STATE_CACHE)
+
+// bytes of a LN message kept by the RX parser (for the dispatch table and
+// the caches)
+#if LN_RX_FILTER && LN_RX_HANDLER_LENGTH > LN_SLOT_COPY
+#define LN_RX_KEEP LN_RX_HANDLER_LENGTH
+#elif LN_SLOT_CACHE
+#define LN_RX_KEEP LN_SLOT_COPY
+#elif LN_RX_FILTER && LN_RX_HANDLER_LENGTH > LN_RX_COPY
+#define LN_RX_KEEP LN_RX_HANDLER_LENGTH
+#elif LN_RX_FILTER || LN_STATE_CACHE
+#define LN_RX_KEEP LN_RX_COPY
+#else
+#define LN_RX_KEEP 0
+#endif
+
+// entry of the dispatch table (indexed by the opcode & 0x7f)
+#define LN_OPCODE(opcode) [(opcode) & 0x7f]
+typedef struct
+    {
+        uint8_t action;             // LN_RX_DROP, LN_RX_QUEUE, LN_RX_HANDLER
+        uint8_t address;            // address format (LN_ADDRESS_NONE, ...)
+        uint16_t min;               // address range (min ... max)
+        uint16_t max;
+        void (*handler)(lnPort_t*, const uint8_t*, uint8_t);
+                                    // handler (port, message, length)
+    } lnRxDispatch_t;
 
 // LN flag register
 typedef struct
@@ -53,17 +172,442 @@ typedef struct
                                     // 1 = running CMP delay
                                     // 2 = running linebreak
                                     // 3 = running synchronisation BRG
+        unsigned TX_MODE :1;        // 1 = LN message in transmission
+        unsigned TX_PRIORITY :2;    // TX priority class of the LN message
+                                    // in transmission
+        unsigned BACKOFF :2;        // linebreaks since the last successful
+                                    // transmission (adaptive backoff)
     } LNCONbits_t;
-LNCONbits_t LNCONbits;
 
-// LN used varibles
-uint8_t _;                          // dummy variable
-uint16_t lastRandomValue;  // initial value for the random generator
+// raw ring: the high priority ISR (top half) only moves the received bytes
+// and the receiver errors from the EUSART to this ring, the low priority ISR
+// (bottom half, software interrupt, see LN_SWI_IF) processes them
+#define LN_RAW_SIZE 16              // 9.6ms of LN data
+#define LN_RAW_MASK (LN_RAW_SIZE - 1)
+#if (LN_RAW_SIZE & LN_RAW_MASK) != 0 || LN_RAW_SIZE > 128
+#error "LN_RAW_SIZE must be a power of 2 and not larger than 128"
+#endif
+#define LN_RAW_DATA 0               // a received byte
+#define LN_RAW_FERR 1               // framing error (linebreak)
+#define LN_RAW_OERR 2               // receiver overrun (a byte is lost)
+
+typedef struct
+    {
+        uint8_t head;               // written by the bottom half only
+        uint8_t tail;               // written by the top half only
+        uint8_t values[LN_RAW_SIZE];
+        uint8_t events[LN_RAW_SIZE];    // LN_RAW_DATA, LN_RAW_FERR, ...
+    } lnRawRing_t;
+
+// LN RX parser (see rxHandler)
+typedef struct
+    {
+        uint8_t length;             // expected length (0 = not yet known)
+        uint8_t count;              // received bytes (0 = no LN message)
+        uint8_t checksum;           // XOR of the received bytes
+        bool discard;               // not stored (LN RX queue full or the
+                                    // opcode is not queued)
+#if LN_RX_KEEP
+        uint8_t message[LN_RX_KEEP];    // first bytes of the LN message
+#endif
+    } lnRxParser_t;
+
+#if LN_SLOT_CACHE
+// state of a slot (the fields of OPC_SL_RD_DATA)
+typedef struct
+    {
+        uint8_t stat1;              // slot status 1 (STAT1)
+        uint8_t address;            // locomotive address A6 ... A0 (ADR)
+        uint8_t address2;           // locomotive address A13 ... A7 (ADR2)
+        uint8_t speed;              // SPD
+        uint8_t dirf;               // direction and F0 ... F4 (DIRF)
+        uint8_t sound;              // F5 ... F8 (SND)
+        uint8_t age;                // lnAgeSlots calls since the last update
+                                    // (LN_SLOT_UNKNOWN: no known state)
+    } lnSlot_t;
+#endif
+
+#if LN_STATE_CACHE
+// bitmaps of the state cache (the state of a sensor is 1 if it is occupied,
+// the state of a switch is 1 if it is closed, the cache starts with 0)
+typedef struct
+    {
+        uint8_t state[LN_STATE_BYTES];
+        uint8_t dirty[LN_STATE_BYTES];  // changed since lnGetStateChange
+        uint8_t summary[LN_STATE_SUMMARY];  // bit per dirty byte (not 0)
+        uint16_t changes;           // number of dirty bits
+    } lnStateCache_t;
+#endif
+
+// LN driver statistics (updated by the ISR, see lnGetStats)
+typedef struct
+    {
+        uint16_t txMessages;        // LN messages transmitted (echo verified)
+        uint16_t rxMessages;        // LN messages received (checksum correct)
+        uint16_t linebreaks;        // linebreaks detected (framing error)
+        uint16_t collisions;        // echo mismatches and busy line at TX
+        uint16_t cmpRestarts;       // CMP delay restarts (LN not free)
+        uint16_t overruns;          // EUSART receiver overruns (OERR)
+        uint16_t rawOverflows;      // bytes lost (raw ring full)
+        uint16_t checksumErrors;    // LN messages with a wrong checksum
+        uint16_t truncatedMessages; // new opcode before the end of a message
+        uint16_t overrunBytes;      // data bytes outside of a LN message
+        uint16_t badLengths;        // invalid length of a variable message
+        uint16_t rxDropped;         // LN messages lost (LN RX queue full)
+        uint16_t rxFiltered;        // LN messages dropped by the dispatch
+        uint16_t rxUnhandled;       // LN messages too long for the handler
+        uint16_t txDropped;         // LN messages refused (LN TX queue full)
+        uint16_t txEvicted;         // LN messages removed to make room
+        uint16_t txCoalesced;       // LN messages replaced in the LN TX queue
+        uint16_t txExpired;         // LN messages out of TX budget
+        uint8_t rxHighWater;        // high-water mark of the LN RX queue
+        uint8_t txHighWater[LN_TX_PRIORITIES];  // and of the LN TX queues
+    } lnStats_t;
+
+// TX latency instrumentation (time from lnSendPriorityMessage until the echo
+// of the last byte is verified), set LN_LATENCY to 1 to build it in
+// the timebase is timer 3 (free running, 1s) extended with a software
+// epoch, so a latency is measured in units of 256s up to 16.7s
+#ifndef LN_LATENCY
+#define LN_LATENCY 0
+#endif
+
+#if LN_LATENCY
+#define LN_LATENCY_BUCKETS 16       // log2 buckets of 256s units
+#define LN_LATENCY_ATTEMPTS 8       // 1 ... 8 (and more) attempts
+
+// LN TX latency histograms (updated by the ISR, see lnGetLatency)
+typedef struct
+    {
+        uint16_t latency[LN_TX_PRIORITIES][LN_LATENCY_BUCKETS];
+                                    // bucket 0: < 512s, bucket i > 0:
+                                    // 2^i ... 2^(i+1) - 1 units of 256s
+        uint16_t attempts[LN_LATENCY_ATTEMPTS];
+                                    // bucket i: transmitted at attempt i + 1
+    } lnLatency_t;
+#endif
+
+// TX budget: with LN_TX_BUDGET set to 1 a LN message can get a maximum
+// number of attempts and/or a deadline (see lnSendBudgetMessage), a LN
+// message out of budget is removed from the LN TX queue before its next
+// attempt and its completion status is reported (see lnGetTxStatus)
+// the deadline is measured on the timebase (units of 256s), timer 1 is
+// restarted for every delay and is stopped in tickless idle
+#ifndef LN_TX_BUDGET
+#define LN_TX_BUDGET 0
+#endif
+
+#if LN_TX_BUDGET
+#define LN_BUDGET_NONE 0            // no limit of attempts, no deadline
+#define LN_TX_STATUS_SIZE 16        // records of the status ring (power of 2)
+#define LN_TX_STATUS_MASK (LN_TX_STATUS_SIZE - 1)
+#if (LN_TX_STATUS_SIZE & LN_TX_STATUS_MASK) != 0 || LN_TX_STATUS_SIZE > 128
+#error "LN_TX_STATUS_SIZE must be a power of 2 and not larger than 128"
+#endif
+#define LN_TX_SENT 0                // completion status: echo verified
+#define LN_TX_ATTEMPTS 1            // no attempts left
+#define LN_TX_DEADLINE 2            // deadline passed
+#define LN_TX_EVICTED 3             // removed to make room (see LN_OVERFLOW)
+
+// TX budget of a LN TX queue entry
+typedef struct
+    {
+        uint8_t attempts;           // maximum attempts (LN_BUDGET_NONE: no
+                                    // limit)
+        uint8_t tag;                // reported in the completion status (0:
+                                    // no completion status)
+        bool timed;                 // the deadline is valid
+        uint16_t deadline;          // timebase (units of 256s)
+    } lnTxBudget_t;
+
+// completion status of a LN message with a tag
+typedef struct
+    {
+        uint8_t tag;
+        uint8_t status;             // LN_TX_SENT, LN_TX_ATTEMPTS, ...
+    } lnTxStatus_t;
+
+typedef struct
+    {
+        uint8_t head;               // written by the main context only
+        uint8_t tail;               // written by the ISR only
+        uint16_t lost;              // records lost (status ring full)
+        lnTxStatus_t records[LN_TX_STATUS_SIZE];
+    } lnTxStatusRing_t;
+#endif
+
+// bus load: with LN_BUS_LOAD set to 1 the driver estimates the load of LN,
+// every byte time seen by the receiver (data or overrun, own echoes
+// included) and every linebreak is counted, the load is the moving average
+// over the last LN_LOAD_WINDOW intervals of 65.5ms (see lnGetBusLoad)
+// TX limiter: with LN_TX_LIMIT set to 1 (implies LN_BUS_LOAD) the LN
+// messages of the normal and low TX priority classes are held back by a
+// token bucket while the bus load is at or above a threshold (see
+// lnSetTxLimit), the high TX priority class is never held back
+#ifndef LN_TX_LIMIT
+#define LN_TX_LIMIT 0
+#endif
+#ifndef LN_BUS_LOAD
+#define LN_BUS_LOAD LN_TX_LIMIT
+#endif
+#if LN_TX_LIMIT && !LN_BUS_LOAD
+#error "LN_TX_LIMIT needs LN_BUS_LOAD"
+#endif
+
+#if LN_BUS_LOAD
+#define LN_LOAD_INTERVAL 256u       // timebase units of 256s (65.5ms)
+#define LN_LOAD_FULL 109u           // byte times (600s) in an interval
+#define LN_LOAD_LINEBREAK 2u        // byte times of a linebreak (framing
+                                    // error detection + 900s)
+#ifndef LN_LOAD_WINDOW
+#define LN_LOAD_WINDOW 16           // intervals (power of 2, 1.05s)
+#endif
+#define LN_LOAD_MASK (LN_LOAD_WINDOW - 1)
+#if (LN_LOAD_WINDOW & LN_LOAD_MASK) != 0 || LN_LOAD_WINDOW > 128
+#error "LN_LOAD_WINDOW must be a power of 2 and not larger than 128"
+#endif
+#ifndef LN_TX_LIMIT_THRESHOLD
+#define LN_TX_LIMIT_THRESHOLD 60u   // bus load in % (0: no limit)
+#endif
+#ifndef LN_TX_LIMIT_RATE
+#define LN_TX_LIMIT_RATE 10u        // token rate in % of the bus capacity
+#endif
+#ifndef LN_TX_LIMIT_BURST
+#define LN_TX_LIMIT_BURST 24u       // token bucket size in bytes
+#endif
+
+// bus load estimator and token bucket (updated by the ISR)
+typedef struct
+    {
+        uint8_t bytes[LN_LOAD_WINDOW];  // byte times per complete interval
+        uint16_t sum;               // byte times of the window
+        uint8_t index;              // oldest complete interval
+        uint8_t current;            // byte times of the current interval
+        uint16_t start;             // timebase at the current interval
+        uint8_t load;               // bus load of the window in %
+#if LN_TX_LIMIT
+        uint8_t threshold;          // bus load in % (0: no limit)
+        uint8_t rate;               // tokens (bytes) per interval
+        uint8_t burst;              // token bucket size in bytes
+        uint8_t tokens;             // tokens in the bucket
+#endif
+    } lnBusLoad_t;
+#endif
+
+// bulk transfer: set LN_BULK to 1 to build the bulk transfer of large blocks
+// of data in (see ln_bulk.h)
+#ifndef LN_BULK
+#define LN_BULK 0
+#endif
+
+// trace capture: with LN_TRACE set to 1 the top half also records every
+// received byte and receiver error with a timestamp (1s) in the trace ring
+// (see lnReadTrace), the records are stored as they are in a trace file
+// (see host/ln_trace.h) and can be replayed into the driver (host/lnreplay)
+#ifndef LN_TRACE
+#define LN_TRACE 0
+#endif
+
+#if LN_TRACE
+#define LN_TRACE_SIZE 64            // records of 4 bytes (power of 2)
+#define LN_TRACE_MASK (LN_TRACE_SIZE - 1)
+#if (LN_TRACE_SIZE & LN_TRACE_MASK) != 0 || LN_TRACE_SIZE > 128
+#error "LN_TRACE_SIZE must be a power of 2 and not larger than 128"
+#endif
+#define LN_TRACE_IDLE 3             // no event, delta = bits 23 ... 16 of
+                                    // the gap to the next record
+#define LN_TRACE_GAP_MASK 0xffffffu // gaps are measured modulo 16.7s
+
+// trace record
+typedef struct
+    {
+        uint8_t delta[2];           // s since the previous record (lsb
+                                    // first)
+        uint8_t event;              // LN_RAW_DATA, LN_RAW_FERR, LN_RAW_OERR
+                                    // or LN_TRACE_IDLE
+        uint8_t value;              // the received byte
+    } lnTraceRecord_t;
+
+typedef struct
+    {
+        uint8_t head;               // written by the main context only
+        uint8_t tail;               // written by the top half only
+        uint16_t lost;              // records lost (trace ring full)
+        lnTraceRecord_t records[LN_TRACE_SIZE];
+    } lnTraceRing_t;
+#endif
+
+// timer 3 (free running timebase) is used by the latency instrumentation,
+// by the TX budget, by the bus load estimator, by the bulk transfer and by
+// the trace capture
+#define LN_TIME (LN_LATENCY || LN_TX_BUDGET || LN_BUS_LOAD || LN_BULK)
+#define LN_TIMEBASE (LN_TIME || LN_TRACE)
+
+// hardware hooks of a LN port, the driver only touches the hardware (EUSART,
+// timer 1, timebase, led) through these routines (see ln_pic18f4620.c)
+typedef struct
+    {
+        void (*init)(lnPort_t*);    // initialise the hardware
+        bool (*isLineFree)(lnPort_t*);  // LN high and no reception
+        void (*writeTx)(lnPort_t*, uint8_t);    // transmit a byte
+        void (*setBRG)(lnPort_t*);  // (re-)start the baudrate generator
+        void (*setLinebreak)(lnPort_t*, bool);
+                                    // true: stop the EUSART and pull LN low
+                                    // false: release LN and enable the EUSART
+        void (*startTimer)(lnPort_t*, uint16_t);
+                                    // (re-)start timer 1 with a delay in s
+        void (*stopTimer)(lnPort_t*);   // stop timer 1 (tickless idle)
+        void (*wakeTimer)(lnPort_t*);   // if timer 1 is stopped, start it
+                                    // and raise its interrupt right away
+        uint8_t (*lockIsr)(lnPort_t*);  // disable the interrupts (critical
+                                    // section of the main context), return
+                                    // the previous state
+        void (*unlockIsr)(lnPort_t*, uint8_t);
+                                    // restore the state of lockIsr
+        void (*setLed)(lnPort_t*, bool);    // led 'data on LN' on/off
+#if LN_TIME
+        uint16_t (*getTime)(lnPort_t*); // timebase in units of 256s
+#endif
+#if LN_TRACE
+        uint32_t (*getMicros)(lnPort_t*);   // timebase in s (at least the
+                                    // bits 23 ... 0 are valid)
+#endif
+    } lnPortHal_t;
+
+// LN port: the hardware hooks and the complete driver state
+struct lnPort_t
+    {
+        const lnPortHal_t* hal;     // hardware hooks
+        void* context;              // free for the hardware hooks
+        LNCONbits_t LNCONbits;      // LN flag register
+        uint16_t lastRandomValue;   // state of the random generator
+        lnRxParser_t rxParser;
+        volatile lnStats_t stats;
+        volatile lnMessageQueue_t txQueue[LN_TX_PRIORITIES];
+        volatile lnMessageQueue_t rxQueue;
+        volatile lnRawRing_t rawRing;
+#if LN_LATENCY
+        volatile lnLatency_t latency;
+        volatile uint16_t txStamp[LN_TX_PRIORITIES][MESSAGE_QUEUE_SIZE];
+                                    // enqueue time per LN TX queue entry
+#endif
+#if LN_LATENCY || LN_TX_BUDGET
+        uint8_t txAttempts[LN_TX_PRIORITIES];
+                                    // attempts of the first LN message
+#endif
+#if LN_TX_BUDGET
+        volatile lnTxBudget_t txBudget[LN_TX_PRIORITIES][MESSAGE_QUEUE_SIZE];
+                                    // TX budget per LN TX queue entry
+        lnTxBudget_t txNextBudget;  // TX budget of the next LN message
+        volatile lnTxStatusRing_t txStatus;
+#endif
+#if LN_BUS_LOAD
+        volatile lnBusLoad_t busLoad;
+#endif
+#if LN_TRACE
+        volatile lnTraceRing_t trace;
+        uint32_t traceTime;         // time of the last trace record
+#endif
+#if LN_SLOT_CACHE
+        volatile lnSlot_t slots[LN_SLOTS];
+#endif
+#if LN_STATE_CACHE
+        volatile lnStateCache_t stateCache;
+#endif
+#if LN_TIMEBASE
+        volatile uint8_t timeEpoch; // timebase overflows (bits 15 ... 8)
+#endif
+    };
+
+void lnInit(lnPort_t*);
+
+void pushRaw(lnPort_t*, uint8_t, uint8_t);
+#if LN_TRACE
+void pushTrace(lnPort_t*, uint8_t, uint8_t);
+uint8_t lnReadTrace(lnPort_t*, lnTraceRecord_t*, uint8_t);
+#endif
+void lnIsrRaw(lnPort_t*);
+void lnIsrTmr1(lnPort_t*);
+void lnIsrRc(lnPort_t*, uint8_t);
 
-volatile lnQueue_t lnTxQueue;
-volatile lnQueue_t lnTxTempQueue;
-volatile lnQueue_t lnRxQueue;
-volatile lnQueue_t lnRxTempQueue;
+void rxHandler(lnPort_t*, uint8_t);
+#if LN_RX_FILTER
+uint8_t dispatchRxMessage(lnPort_t*);
+#endif
+
+bool lnSendMessage(lnPort_t*, const uint8_t*, uint8_t);
+bool lnSendPriorityMessage(lnPort_t*, uint8_t, const uint8_t*, uint8_t);
+bool lnSendBuiltMessage(lnPort_t*, uint8_t, const uint8_t*);
+#if LN_TX_BUDGET
+bool lnSendBudgetMessage(lnPort_t*, uint8_t, const uint8_t*, uint8_t, uint8_t, uint16_t, uint8_t);
+#endif
+uint8_t lnReceiveMessage(lnPort_t*, uint8_t*, uint8_t);
+
+#if LN_TX_COALESCE
+bool coalesceMessage(lnPort_t*, volatile lnMessageQueue_t*, const uint8_t*, uint8_t);
+uint8_t getCoalesceFormat(uint8_t);
+#endif
+#if LN_OVERFLOW == LN_OVERFLOW_DROP_OLDEST
+bool evictMessage(lnPort_t*, uint8_t);
+#endif
+uint8_t getTxPriority(lnPort_t*);
+void startTxLnMessage(lnPort_t*, uint8_t);
+#if LN_TX_BUDGET
+void expireTxMessages(lnPort_t*);
+void completeTxMessage(lnPort_t*, uint8_t, uint8_t, uint8_t);
+bool lnGetTxStatus(lnPort_t*, uint8_t*, uint8_t*);
+#endif
+void txHandler(lnPort_t*);
+
+#if LN_BUS_LOAD
+void updateBusLoad(lnPort_t*);
+uint8_t lnGetBusLoad(lnPort_t*);
+#endif
+#if LN_TX_LIMIT
+bool isTxLimited(lnPort_t*, uint8_t);
+void takeTxTokens(lnPort_t*, uint8_t, uint8_t);
+void lnSetTxLimit(lnPort_t*, uint8_t, uint8_t, uint8_t);
+#endif
+
+void updateHighWater(volatile uint8_t*, volatile lnMessageQueue_t*);
+void lnGetStats(lnPort_t*, lnStats_t*, bool);
+#if LN_LATENCY
+void updateLatency(lnPort_t*, uint8_t, uint8_t);
+void lnGetLatency(lnPort_t*, lnLatency_t*, bool);
+#endif
+
+#if LN_CACHE
+void updateCaches(lnPort_t*, const uint8_t*, uint8_t);
+void cacheTxMessage(lnPort_t*, volatile lnMessageQueue_t*);
+#endif
+#if LN_SLOT_CACHE
+void updateSlotCache(lnPort_t*, const uint8_t*, uint8_t);
+bool lnGetSlot(lnPort_t*, uint8_t, uint8_t, lnSlot_t*);
+void lnAgeSlots(lnPort_t*);
+#endif
+#if LN_STATE_CACHE
+void updateStateCache(lnPort_t*, const uint8_t*, uint8_t);
+void setCachedState(lnPort_t*, uint16_t, bool);
+uint8_t lnGetStateChange(lnPort_t*, uint16_t*, bool*);
+bool lnGetSensor(lnPort_t*, uint16_t);
+bool lnGetSwitch(lnPort_t*, uint16_t);
+#endif
+
+bool isLnFree(lnPort_t*);
+#if LN_RX_FILTER || LN_TX_COALESCE || LN_STATE_CACHE
+uint16_t getLnAddress(const uint8_t*, uint8_t);
+#endif
+
+void startIdleDelay(lnPort_t*);
+#if LN_TICKLESS
+void stopTmr1(lnPort_t*);
+void wakeUpTmr1(lnPort_t*);
+#endif
+void startCmpDelay(lnPort_t*);
+void startLinebreak(lnPort_t*, uint16_t);
+void startSyncBRG(lnPort_t*);
+
+uint16_t getRandomValue(uint16_t);
 
 #endif	/* LN_H */
 
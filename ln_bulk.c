@@ -0,0 +1,443 @@
+/*
+ * file: ln_bulk.c
+ * author: Geert Giebens, Jan van Hooydonk
+ * comments: LocoNet driver - bulk transfer (used if LN_BULK = 1)
+ *
+ */
+
+#include <string.h>
+#include "ln_bulk.h"
+
+#if LN_BULK
+
+// <editor-fold defaultstate="collapsed" desc="sender">
+
+/**
+ * initialise a sender (the source routine is set by the application)
+ * @param sender: the sender
+ * @param port: the LN port
+ * @param node: own node id (7 bits)
+ */
+void lnBulkInitSender(lnBulkSender_t* sender, lnPort_t* port, uint8_t node)
+{
+    memset(sender, 0, sizeof(lnBulkSender_t));
+    sender->port = port;
+    sender->node = node & 0x7f;
+    sender->window = LN_BULK_WINDOW;
+}
+
+/**
+ * start a bulk transfer (the data is read with the source routine)
+ * @param sender: the sender
+ * @param peer: node id of the receiver
+ * @param session: id of the transfer (4 bits), a receiver starts a new
+ * transfer on a new session
+ * @param size: the number of bytes (1 ... 65535 blocks)
+ * @return true: if the transfer is started, false: if a transfer is busy
+ * or the size is invalid
+ */
+bool lnBulkSend(lnBulkSender_t* sender, uint8_t peer, uint8_t session, uint32_t size)
+{
+    uint32_t blocks = (size + LN_BULK_BLOCK - 1u) / LN_BULK_BLOCK;
+    if (sender->state == LN_BULK_BUSY || blocks == 0 || blocks > 0xffffu)
+    {
+        return false;
+    }
+    if (sender->window < 1 || sender->window > LN_BULK_WINDOW)
+    {
+        sender->window = LN_BULK_WINDOW;
+    }
+    sender->peer = peer & 0x7f;
+    sender->session = session & LN_BULK_SESSION_MASK;
+    sender->size = size;
+    sender->blocks = (uint16_t)blocks;
+    sender->base = 0;
+    sender->next = 0;
+    sender->acked = 0;
+    sender->lost = 0;
+    sender->retransmissions = 0;
+    sender->state = LN_BULK_BUSY;
+    return true;
+}
+
+/**
+ * send the next block of a bulk transfer (called in the main loop): first a
+ * lost block, then the first block if no ACK came in time, else a new block
+ * if the window allows it
+ * @param sender: the sender
+ */
+void lnBulkPollSender(lnBulkSender_t* sender)
+{
+    // one block at a time on the LN TX queue (a block fills it)
+    if (sender->state != LN_BULK_BUSY ||
+            !isMessageQueueEmpty(&sender->port->txQueue[LN_BULK_PRIORITY_DATA]))
+    {
+        return;
+    }
+    uint16_t now = sender->port->hal->getTime(sender->port);
+    uint8_t inFlight = (uint8_t)(sender->next - sender->base);
+    if (inFlight == 0)
+    {
+        // nothing waits for an ACK
+        sender->ackTime = now;
+    }
+    for (uint8_t i = 0; i < inFlight; i++)
+    {
+        uint32_t bit = (uint32_t)1 << i;
+        if ((sender->lost & bit) != 0 || (i == 0 &&
+                (uint16_t)(now - sender->ackTime) >= LN_BULK_TIMEOUT))
+        {
+            // a lost block (see lnBulkSenderMessage), or no ACK in time
+            // (the last blocks or the ACK are lost): retransmit the first
+            // block and wait for its ACK
+            if (sender->retries[(sender->base + i) % LN_BULK_WINDOW] >= LN_BULK_RETRIES)
+            {
+                sender->state = LN_BULK_FAILED;
+            }
+            else if (sendBulkBlock(sender, sender->base + i))
+            {
+                sender->lost &= ~bit;
+                sender->retransmissions++;
+                sender->ackTime = now;
+            }
+            return;
+        }
+    }
+    if (sender->next < sender->blocks && inFlight < sender->window &&
+            sendBulkBlock(sender, sender->next))
+    {
+        sender->next++;
+    }
+}
+
+/**
+ * handle a received LN message (an ACK of the receiver)
+ * @param sender: the sender
+ * @param message: the LN message
+ * @param length: the length of the LN message
+ * @return true: if the LN message is an ACK for the sender
+ */
+bool lnBulkSenderMessage(lnBulkSender_t* sender, const uint8_t* message, uint8_t length)
+{
+    if (message[0] != LN_BULK_OPCODE || length != LN_BULK_ACK ||
+            message[2] != LN_BULK_SIGNATURE ||
+            message[3] != sender->peer || message[4] != sender->node ||
+            message[5] != (LN_BULK_TYPE_ACK | sender->session))
+    {
+        return false;
+    }
+    uint8_t inFlight = (uint8_t)(sender->next - sender->base);
+    uint8_t shift = (message[6] - sender->base) & 0x7f;
+    if (sender->state != LN_BULK_BUSY || shift > inFlight)
+    {
+        // an old ACK
+        return true;
+    }
+    // the blocks before the first missing block and the blocks of the
+    // bitmap have an ACK
+    uint32_t bitmap = (uint32_t)message[7] | ((uint32_t)message[8] << 7) |
+            ((uint32_t)message[9] << 14) | ((uint32_t)message[10] << 21);
+    uint32_t mask = ((uint32_t)1 << inFlight) - 1u;
+    sender->acked |= ((((uint32_t)1 << shift) - 1u) | (bitmap << (shift + 1u))) & mask;
+
+    // LN keeps the order of the LN messages, so a block without ACK that
+    // was sent before a block with ACK is lost
+    int8_t highest = -1;
+    for (uint8_t i = 0; i < inFlight; i++)
+    {
+        if (sender->acked & ((uint32_t)1 << i))
+        {
+            highest = (int8_t)i;
+        }
+    }
+    if (highest > 0)
+    {
+        uint16_t order = sender->sendOrder[(sender->base + (uint8_t)highest) % LN_BULK_WINDOW];
+        for (uint8_t i = 0; i < (uint8_t)highest; i++)
+        {
+            uint32_t bit = (uint32_t)1 << i;
+            uint8_t slot = (uint8_t)((sender->base + i) % LN_BULK_WINDOW);
+            if ((sender->acked & bit) == 0 && (int16_t)(sender->sendOrder[slot] - order) < 0)
+            {
+                sender->lost |= bit;
+            }
+        }
+    }
+
+    // move the window
+    sender->ackTime = sender->port->hal->getTime(sender->port);
+    while (sender->acked & 1u)
+    {
+        sender->acked >>= 1;
+        sender->lost >>= 1;
+        sender->base++;
+    }
+    if (sender->base == sender->blocks)
+    {
+        sender->state = LN_BULK_DONE;
+    }
+    return true;
+}
+
+/**
+ * put a block on the LN TX queue
+ * @param sender: the sender
+ * @param block: the block number
+ * @return true: if the block is queued, false: if the LN TX queue is full
+ */
+bool sendBulkBlock(lnBulkSender_t* sender, uint16_t block)
+{
+    uint8_t data[LN_BULK_BLOCK];
+    uint8_t message[LN_BULK_MESSAGE];
+    uint32_t offset = (uint32_t)block * LN_BULK_BLOCK;
+    uint8_t length = (sender->size - offset < LN_BULK_BLOCK) ?
+            (uint8_t)(sender->size - offset) : LN_BULK_BLOCK;
+    uint8_t slot = (uint8_t)(block % LN_BULK_WINDOW);
+    bool last = (block == sender->blocks - 1u);
+
+    sender->read(sender, offset, data, length);
+    message[0] = LN_BULK_OPCODE;
+    message[2] = LN_BULK_SIGNATURE;
+    message[3] = sender->node;
+    message[4] = sender->peer;
+    message[5] = sender->session;
+    if (last)
+    {
+        message[5] |= LN_BULK_TYPE_LAST;
+    }
+    if (last || block != sender->next || block + 1u - sender->base == sender->window)
+    {
+        // the last block, a retransmission or a full window: the sender
+        // waits for an ACK
+        message[5] |= LN_BULK_TYPE_REQUEST;
+    }
+    message[6] = block & 0x7f;
+    length = LN_BULK_HEADER + encodeBulkData(&message[LN_BULK_HEADER], data, length) + 1u;
+    message[1] = length;
+    uint8_t checksum = 0xff;
+    for (uint8_t i = 0; i < length - 1u; i++)
+    {
+        checksum ^= message[i];
+    }
+    message[length - 1u] = checksum;
+    if (!lnSendPriorityMessage(sender->port, LN_BULK_PRIORITY_DATA, message, length))
+    {
+        return false;
+    }
+    if (block == sender->next)
+    {
+        sender->retries[slot] = 0;
+    }
+    sender->retries[slot]++;
+    sender->sendOrder[slot] = ++sender->sendCount;
+    return true;
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="receiver">
+
+/**
+ * initialise a receiver (the sink routine is set by the application)
+ * @param receiver: the receiver
+ * @param port: the LN port
+ * @param node: own node id (7 bits)
+ */
+void lnBulkInitReceiver(lnBulkReceiver_t* receiver, lnPort_t* port, uint8_t node)
+{
+    memset(receiver, 0, sizeof(lnBulkReceiver_t));
+    receiver->port = port;
+    receiver->node = node & 0x7f;
+}
+
+/**
+ * send a pending ACK (called in the main loop)
+ * @param receiver: the receiver
+ */
+void lnBulkPollReceiver(lnBulkReceiver_t* receiver)
+{
+    if (receiver->ackPending)
+    {
+        sendBulkAck(receiver);
+    }
+}
+
+/**
+ * handle a received LN message (a block of the sender), the block is
+ * written with the sink routine
+ * @param receiver: the receiver
+ * @param message: the LN message
+ * @param length: the length of the LN message
+ * @return true: if the LN message is a block for the receiver
+ */
+bool lnBulkReceiverMessage(lnBulkReceiver_t* receiver, const uint8_t* message, uint8_t length)
+{
+    if (message[0] != LN_BULK_OPCODE || length <= LN_BULK_HEADER + 1u ||
+            length > LN_BULK_MESSAGE || message[2] != LN_BULK_SIGNATURE ||
+            message[4] != receiver->node || (message[5] & LN_BULK_TYPE_ACK))
+    {
+        return false;
+    }
+    uint8_t session = message[5] & LN_BULK_SESSION_MASK;
+    if (receiver->state == LN_BULK_IDLE || message[3] != receiver->peer ||
+            session != receiver->session)
+    {
+        // a new transfer
+        receiver->peer = message[3];
+        receiver->session = session;
+        receiver->state = LN_BULK_BUSY;
+        receiver->base = 0;
+        receiver->highest = 0;
+        receiver->last = 0xffff;
+        receiver->received = 0;
+        receiver->size = 0;
+        receiver->fresh = 0;
+        receiver->duplicates = 0;
+    }
+    if (message[5] & LN_BULK_TYPE_REQUEST)
+    {
+        receiver->ackPending = true;
+    }
+
+    uint8_t shift = (message[6] - receiver->base) & 0x7f;
+    if (receiver->state == LN_BULK_DONE || shift > LN_BULK_ACK_BITS ||
+            (receiver->received & ((uint32_t)1 << shift)))
+    {
+        // a block that is already written (its ACK is lost), or a block
+        // outside of the window
+        receiver->duplicates++;
+        receiver->ackPending = true;
+    }
+    else
+    {
+        uint8_t data[LN_BULK_BLOCK + 1u];
+        uint16_t block = receiver->base + shift;
+        uint8_t count = decodeBulkData(data, &message[LN_BULK_HEADER],
+                length - LN_BULK_HEADER - 1u);
+        if (message[5] & LN_BULK_TYPE_LAST)
+        {
+            receiver->last = block;
+            receiver->size = (uint32_t)block * LN_BULK_BLOCK + count;
+        }
+        else if (count != LN_BULK_BLOCK)
+        {
+            return true;
+        }
+        receiver->write(receiver, (uint32_t)block * LN_BULK_BLOCK, data, count);
+        receiver->received |= (uint32_t)1 << shift;
+        if (block > receiver->highest)
+        {
+            // a block is missing: ACK now, so the sender retransmits it
+            receiver->ackPending = true;
+        }
+        if (block + 1u > receiver->highest)
+        {
+            receiver->highest = block + 1u;
+        }
+        while (receiver->received & 1u)
+        {
+            receiver->received >>= 1;
+            receiver->base++;
+        }
+        if (++receiver->fresh >= LN_BULK_ACK_EVERY)
+        {
+            receiver->ackPending = true;
+        }
+        if (receiver->last != 0xffff && receiver->base > receiver->last)
+        {
+            receiver->state = LN_BULK_DONE;
+            receiver->ackPending = true;
+        }
+    }
+    lnBulkPollReceiver(receiver);
+    return true;
+}
+
+/**
+ * put an ACK on the LN TX queue
+ * @param receiver: the receiver
+ * @return true: if the ACK is queued, false: if the LN TX queue is full
+ */
+bool sendBulkAck(lnBulkReceiver_t* receiver)
+{
+    uint8_t message[LN_BULK_ACK];
+    uint32_t bitmap = receiver->received >> 1;
+    message[0] = LN_BULK_OPCODE;
+    message[1] = LN_BULK_ACK;
+    message[2] = LN_BULK_SIGNATURE;
+    message[3] = receiver->node;
+    message[4] = receiver->peer;
+    message[5] = LN_BULK_TYPE_ACK | receiver->session;
+    message[6] = receiver->base & 0x7f;
+    uint8_t checksum = 0xff;
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        message[7 + i] = (uint8_t)(bitmap >> (7 * i)) & 0x7f;
+    }
+    for (uint8_t i = 0; i < LN_BULK_ACK - 1u; i++)
+    {
+        checksum ^= message[i];
+    }
+    message[LN_BULK_ACK - 1u] = checksum;
+    if (!lnSendPriorityMessage(receiver->port, LN_BULK_PRIORITY_ACK, message, LN_BULK_ACK))
+    {
+        return false;
+    }
+    receiver->ackPending = false;
+    receiver->fresh = 0;
+    return true;
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="encoding">
+
+/**
+ * encode bytes in groups of 7 (a byte with the msb of the group, then the
+ * 7 lsb of the bytes)
+ * @param encoded: buffer for the encoded bytes (length + length / 7 + 1)
+ * @param data: the bytes
+ * @param length: the number of bytes
+ * @return the number of encoded bytes
+ */
+uint8_t encodeBulkData(uint8_t* encoded, const uint8_t* data, uint8_t length)
+{
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < length; i += 7)
+    {
+        uint8_t msb = 0;
+        uint8_t position = count++;
+        for (uint8_t j = 0; j < 7 && i + j < length; j++)
+        {
+            msb |= (uint8_t)((data[i + j] >> 7) << j);
+            encoded[count++] = data[i + j] & 0x7f;
+        }
+        encoded[position] = msb;
+    }
+    return count;
+}
+
+/**
+ * decode bytes in groups of 7 (see encodeBulkData)
+ * @param data: buffer for the bytes
+ * @param encoded: the encoded bytes
+ * @param length: the number of encoded bytes
+ * @return the number of bytes
+ */
+uint8_t decodeBulkData(uint8_t* data, const uint8_t* encoded, uint8_t length)
+{
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < length; i += 8)
+    {
+        uint8_t msb = encoded[i];
+        for (uint8_t j = 0; j < 7 && i + j + 1 < length; j++)
+        {
+            data[count++] = encoded[i + j + 1] | (uint8_t)(((msb >> j) & 1u) << 7);
+        }
+    }
+    return count;
+}
+
+// </editor-fold>
+
+#endif
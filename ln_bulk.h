@@ -0,0 +1,157 @@
+/*
+ * file: ln_bulk.h
+ * author: Geert Giebens, Jan van Hooydonk
+ * comments: LocoNet driver - bulk transfer (used if LN_BULK = 1)
+ *
+ * streaming transfer of a large block of data (eg. a firmware image or a
+ * configuration) from a sender to a receiver, in blocks of LN_BULK_BLOCK
+ * bytes. Every block is one bulk message of maximum size, the sender
+ * keeps a window of blocks on LN without waiting for every answer, the
+ * receiver acknowledges the blocks with a bitmap (selective ACK) and the
+ * sender only retransmits the blocks that are lost.
+ *
+ * bulk message (variable length):
+ *  <LN_BULK_OPCODE>, <length>, <0x42>, <src>, <dst>, <type>, <seq>,
+ *  <data ...>, <checksum>
+ *  0x42: signature (LN_BULK_SIGNATURE)
+ *  src, dst: node ids (7 bits)
+ *  type: bits 3 ... 0: session, bit 4: the sender waits for an ACK, bit 5:
+ *  1: ACK, 0: block, bit 6: last block of the transfer
+ *  block: seq = block number (7 lsb), data = the bytes of the block in
+ *  groups of 7: a byte with the msb of the group (bit i: msb of byte i)
+ *  followed by the 7 lsb of the bytes of the group
+ *  ACK: seq = first missing block (7 lsb), data = 4 bytes, bits 6 ... 0:
+ *  the blocks seq + 1 ... seq + 28 are received (bitmap, lsb first)
+ *
+ * LN has no free variable length opcode: the default LN_BULK_OPCODE 0xe0 is
+ * OPC_MULTI_SENSE_LONG (transponding) in JMRI, so a bulk message is only
+ * accepted with the signature and the length of a block or an ACK, and an
+ * installation that uses OPC_MULTI_SENSE_LONG sets LN_BULK_OPCODE to an
+ * opcode that is not used on its LN
+ *
+ * the sender reads the data with the source routine and the receiver writes
+ * it with the sink routine, both at an offset in the data, the blocks come
+ * in the order of LN, so a retransmitted block can be written after the
+ * blocks that follow it. The application passes every received LN message
+ * to lnBulkSenderMessage/lnBulkReceiverMessage and calls the poll routine
+ * in the main loop (a block takes 72ms on LN, the LN RX queue only holds
+ * one block). The blocks have the low priority and only take the time of
+ * LN that the other LN messages of the node leave, the ACKs have the high
+ * priority.
+ *
+ * revision history:
+ *  v1.0 Creation (16/10/2026)
+ */
+
+// this is a guard condition so that contents of this file are not included
+// more than once
+#ifndef LN_BULK_H
+#define	LN_BULK_H
+
+#include "ln.h"
+#include "ln_message.h"
+
+#if LN_BULK
+
+#ifndef LN_BULK_OPCODE
+#define LN_BULK_OPCODE 0xe0u        // opcode of the bulk messages (variable
+#endif                              // length, see above)
+#if (LN_BULK_OPCODE & 0xe0u) != 0xe0u
+#error "LN_BULK_OPCODE must be a variable length opcode (0xe0 ... 0xff)"
+#endif
+#define LN_BULK_SIGNATURE 0x42      // third byte of a bulk message
+#define LN_BULK_HEADER 7            // opcode ... seq
+#define LN_BULK_BLOCK 98u           // data bytes per block (14 groups)
+#define LN_BULK_MESSAGE 120u        // length of a full block
+#define LN_BULK_ACK 12u             // length of an ACK
+#define LN_BULK_ACK_BITS 28         // blocks in the bitmap of an ACK
+#ifndef LN_BULK_WINDOW
+#define LN_BULK_WINDOW 16           // maximum blocks on LN without ACK
+#endif
+#if LN_BULK_WINDOW < 1 || LN_BULK_WINDOW > LN_BULK_ACK_BITS
+#error "LN_BULK_WINDOW must be 1 ... 28"
+#endif
+#define LN_BULK_ACK_EVERY 4         // blocks per ACK of the receiver
+#define LN_BULK_TIMEOUT 4000u       // no ACK: retransmission of the first
+                                    // block (units of 256s, 1.02s)
+#define LN_BULK_RETRIES 8           // transmissions of a block
+#define LN_BULK_TYPE_REQUEST 0x10
+#define LN_BULK_TYPE_ACK 0x20
+#define LN_BULK_TYPE_LAST 0x40
+#define LN_BULK_SESSION_MASK 0x0f
+#define LN_BULK_PRIORITY_DATA LN_PRIORITY_LOW
+#define LN_BULK_PRIORITY_ACK LN_PRIORITY_HIGH
+
+#define LN_BULK_IDLE 0              // state of a sender or a receiver
+#define LN_BULK_BUSY 1
+#define LN_BULK_DONE 2
+#define LN_BULK_FAILED 3            // sender: a block is out of retries
+
+typedef struct lnBulkSender_t lnBulkSender_t;
+typedef struct lnBulkReceiver_t lnBulkReceiver_t;
+
+// sender of a bulk transfer
+struct lnBulkSender_t
+    {
+        lnPort_t* port;
+        void (*read)(lnBulkSender_t*, uint32_t, uint8_t*, uint8_t);
+                                    // source: read the bytes at an offset
+        void* context;              // free for the source
+        uint8_t node;               // own node id
+        uint8_t peer;               // node id of the receiver
+        uint8_t session;
+        uint8_t state;              // LN_BULK_IDLE, ...
+        uint8_t window;             // blocks on LN without ACK (1: stop
+                                    // and wait)
+        uint32_t size;              // bytes of the transfer
+        uint16_t blocks;            // blocks of the transfer
+        uint16_t base;              // first block without ACK
+        uint16_t next;              // next block that was never sent
+        uint32_t acked;             // bit i: block base + i has an ACK
+        uint32_t lost;              // bit i: block base + i is lost
+        uint16_t ackTime;           // time of the last ACK (or of the
+                                    // first block without ACK)
+        uint16_t sendCount;         // transmissions (order of the blocks)
+        uint16_t sendOrder[LN_BULK_WINDOW];     // per block % window: last
+        uint8_t retries[LN_BULK_WINDOW];        // transmission, transmissions
+        uint16_t retransmissions;   // statistics
+    };
+
+// receiver of a bulk transfer
+struct lnBulkReceiver_t
+    {
+        lnPort_t* port;
+        void (*write)(lnBulkReceiver_t*, uint32_t, const uint8_t*, uint8_t);
+                                    // sink: write the bytes at an offset
+        void* context;              // free for the sink
+        uint8_t node;               // own node id
+        uint8_t peer;               // node id of the sender
+        uint8_t session;
+        uint8_t state;              // LN_BULK_IDLE, ...
+        uint16_t base;              // first missing block
+        uint16_t highest;           // highest received block + 1
+        uint16_t last;              // last block (0xffff: not yet known)
+        uint32_t received;          // bit i: block base + i is received
+        uint32_t size;              // bytes of the transfer (when done)
+        uint8_t fresh;              // new blocks since the last ACK
+        bool ackPending;            // an ACK has to be sent
+        uint16_t duplicates;        // statistics
+    };
+
+void lnBulkInitSender(lnBulkSender_t*, lnPort_t*, uint8_t);
+bool lnBulkSend(lnBulkSender_t*, uint8_t, uint8_t, uint32_t);
+void lnBulkPollSender(lnBulkSender_t*);
+bool lnBulkSenderMessage(lnBulkSender_t*, const uint8_t*, uint8_t);
+bool sendBulkBlock(lnBulkSender_t*, uint16_t);
+
+void lnBulkInitReceiver(lnBulkReceiver_t*, lnPort_t*, uint8_t);
+void lnBulkPollReceiver(lnBulkReceiver_t*);
+bool lnBulkReceiverMessage(lnBulkReceiver_t*, const uint8_t*, uint8_t);
+bool sendBulkAck(lnBulkReceiver_t*);
+
+uint8_t encodeBulkData(uint8_t*, const uint8_t*, uint8_t);
+uint8_t decodeBulkData(uint8_t*, const uint8_t*, uint8_t);
+
+#endif
+
+#endif	/* LN_BULK_H */
@@ -0,0 +1,33 @@
+/*
+ * file: ln_dispatch.c
+ * author: Geert Giebens, Jan van Hooydonk
+ * comments: LocoNet driver - RX dispatch table (used if LN_RX_FILTER = 1)
+ *
+ * the dispatch table of the application (see ln_dispatch.h), eg. a handler
+ * for the sensor reports of the addresses 0 ... 63:
+ *  void sensorHandler(lnPort_t*, const uint8_t*, uint8_t);
+ *  LN_OPCODE(0xb2) = { LN_RX_HANDLER, LN_ADDRESS_SENSOR, 0u, 63u, sensorHandler }
+ *
+ * revision history:
+ *  v1.0 Creation (16/10/2026)
+ */
+
+#include "ln_dispatch.h"
+
+#if LN_RX_FILTER
+
+const lnRxDispatch_t lnRxDispatch[128] =
+{
+    LN_OPCODE(0x82) = { LN_RX_QUEUE, LN_ADDRESS_NONE, 0u, 0u, 0 },
+                                    // OPC_GPOFF
+    LN_OPCODE(0x83) = { LN_RX_QUEUE, LN_ADDRESS_NONE, 0u, 0u, 0 },
+                                    // OPC_GPON
+    LN_OPCODE(0x85) = { LN_RX_QUEUE, LN_ADDRESS_NONE, 0u, 0u, 0 },
+                                    // OPC_IDLE
+    LN_OPCODE(0xb0) = { LN_RX_QUEUE, LN_ADDRESS_SWITCH, 0u, 15u, 0 },
+                                    // OPC_SW_REQ of switch 1 ... 16
+    LN_OPCODE(0xbc) = { LN_RX_QUEUE, LN_ADDRESS_SWITCH, 0u, 15u, 0 }
+                                    // OPC_SW_STATE of switch 1 ... 16
+};
+
+#endif
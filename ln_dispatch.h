@@ -0,0 +1,31 @@
+/*
+ * file: ln_dispatch.h
+ * author: Geert Giebens, Jan van Hooydonk
+ * comments: LocoNet driver - RX dispatch table (used if LN_RX_FILTER = 1)
+ *
+ * the dispatch table is indexed by the opcode (LN_OPCODE), opcodes that are
+ * not in the table are dropped. Every entry tells what to do with a valid
+ * LN message of the opcode:
+ *  action: LN_RX_QUEUE: put it on the LN RX queue (see lnReceiveMessage)
+ *          LN_RX_HANDLER: call the handler, in the ISR (LN messages of
+ *          maximum LN_RX_HANDLER_LENGTH bytes, longer ones are counted in
+ *          rxUnhandled)
+ *  address, min, max: only LN messages with an address in min ... max
+ *
+ * the table is defined in ln_dispatch.c, an application with its own table
+ * replaces ln_dispatch.c (this header stays the same)
+ *
+ * revision history:
+ *  v1.0 Creation (16/10/2026)
+ */
+
+// this is a guard condition so that contents of this file are not included
+// more than once
+#ifndef LN_DISPATCH_H
+#define	LN_DISPATCH_H
+
+#include "ln.h"
+
+extern const lnRxDispatch_t lnRxDispatch[128];
+
+#endif	/* LN_DISPATCH_H */
@@ -0,0 +1,177 @@
+/*
+ * file: ln_message.h
+ * author: Geert Giebens, Jan van Hooydonk
+ * comments: LocoNet driver - LN message builder
+ *
+ * every builder gives the bytes of a LN message, checksum included, as a
+ * compound literal (const uint8_t[]), eg.:
+ *  lnSendBuiltMessage(&lnPort, LN_PRIORITY_HIGH, LN_SW_REQ(12u, true, true));
+ *  static const uint8_t gpOff[] = LN_GPOFF_BYTES;
+ * with constant arguments the bytes and the checksum are computed by the
+ * compiler, lnSendBuiltMessage takes the length from the opcode (or from the
+ * second byte of a variable length LN message). The arguments of a builder
+ * are evaluated more than once.
+ *
+ * addresses are the ones of the driver (see getLnAddress): switch 0 ... 2047
+ * is switch 1 ... 2048, sensor 0 ... 4095 is sensor 1 ... 4096
+ *
+ * revision history:
+ *  v1.0 Creation (16/10/2026)
+ */
+
+// this is a guard condition so that contents of this file are not included
+// more than once
+#ifndef LN_MESSAGE_H
+#define	LN_MESSAGE_H
+
+#include "ln.h"
+
+// <editor-fold defaultstate="collapsed" desc="opcodes">
+
+#define OPC_GPOFF 0x82u
+#define OPC_GPON 0x83u
+#define OPC_LOCO_SPD 0xa0u
+#define OPC_LOCO_DIRF 0xa1u
+#define OPC_LOCO_SND 0xa2u
+#define OPC_SW_REQ 0xb0u
+#define OPC_INPUT_REP 0xb2u
+#define OPC_LONG_ACK 0xb4u
+#define OPC_RQ_SL_DATA 0xbbu
+#define OPC_PEER_XFER 0xe5u
+#define OPC_WR_SL_DATA 0xefu
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="encoding">
+
+// the bytes of a LN message of 2, 4 or 6 bytes with the checksum
+#define LN_BYTES2(opcode) \
+        { (uint8_t)(opcode), (uint8_t)(0xffu ^ (opcode)) }
+#define LN_BYTES4(opcode, b1, b2) \
+        { (uint8_t)(opcode), (uint8_t)(b1), (uint8_t)(b2), \
+        (uint8_t)(0xffu ^ (opcode) ^ (b1) ^ (b2)) }
+
+// a byte with the msb cleared, and its msb at a position of a PXCT byte
+#define LN_LOW7(value) ((uint8_t)((value) & 0x7fu))
+#define LN_MSB(value, position) ((uint8_t)((((value) >> 7) & 1u) << (position)))
+
+// switch: A6 ... A0 in byte 1, A10 ... A7 in byte 2
+#define LN_SWITCH_LOW(address) LN_LOW7(address)
+#define LN_SWITCH_HIGH(address) ((uint8_t)(((address) >> 7) & 0x0fu))
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="builders">
+
+// global power off and on
+#define LN_GPOFF_BYTES LN_BYTES2(OPC_GPOFF)
+#define LN_GPON_BYTES LN_BYTES2(OPC_GPON)
+#define LN_GPOFF ((const uint8_t[])LN_GPOFF_BYTES)
+#define LN_GPON ((const uint8_t[])LN_GPON_BYTES)
+
+/**
+ * OPC_SW_REQ: switch request
+ * @param address: the switch (0 ... 2047)
+ * @param closed: true: closed (DIR = 1), false: thrown
+ * @param on: true: output on, false: output off
+ */
+#define LN_SW_REQ_BYTES(address, closed, on) \
+        LN_BYTES4(OPC_SW_REQ, LN_SWITCH_LOW(address), \
+        LN_SWITCH_HIGH(address) | ((closed) ? 0x20u : 0u) | ((on) ? 0x10u : 0u))
+#define LN_SW_REQ(address, closed, on) \
+        ((const uint8_t[])LN_SW_REQ_BYTES(address, closed, on))
+
+/**
+ * OPC_INPUT_REP: sensor report (the reserved X bit is set)
+ * @param address: the sensor (0 ... 4095, the lsb is the I bit)
+ * @param occupied: the state of the sensor (L)
+ */
+#define LN_INPUT_REP_BYTES(address, occupied) \
+        LN_BYTES4(OPC_INPUT_REP, LN_LOW7((address) >> 1), \
+        (uint8_t)((((address) >> 8) & 0x0fu) | (((address) & 1u) << 5) | \
+        ((occupied) ? 0x10u : 0u) | 0x40u))
+#define LN_INPUT_REP(address, occupied) \
+        ((const uint8_t[])LN_INPUT_REP_BYTES(address, occupied))
+
+/**
+ * OPC_LOCO_SPD, OPC_LOCO_DIRF, OPC_LOCO_SND: speed, direction and F0 ... F4,
+ * F5 ... F8 of a slot
+ * @param slot: the slot (1 ... 119)
+ * @param speed: SPD (0: stop, 1: emergency stop, 2 ... 127: speed steps)
+ * @param dirf: DIRF (see LN_DIRF)
+ * @param sound: SND (F8 ... F5 in bits 3 ... 0)
+ */
+#define LN_LOCO_SPD_BYTES(slot, speed) \
+        LN_BYTES4(OPC_LOCO_SPD, LN_LOW7(slot), LN_LOW7(speed))
+#define LN_LOCO_DIRF_BYTES(slot, dirf) \
+        LN_BYTES4(OPC_LOCO_DIRF, LN_LOW7(slot), LN_LOW7(dirf))
+#define LN_LOCO_SND_BYTES(slot, sound) \
+        LN_BYTES4(OPC_LOCO_SND, LN_LOW7(slot), LN_LOW7(sound))
+#define LN_LOCO_SPD(slot, speed) ((const uint8_t[])LN_LOCO_SPD_BYTES(slot, speed))
+#define LN_LOCO_DIRF(slot, dirf) ((const uint8_t[])LN_LOCO_DIRF_BYTES(slot, dirf))
+#define LN_LOCO_SND(slot, sound) ((const uint8_t[])LN_LOCO_SND_BYTES(slot, sound))
+
+// DIRF: direction (1: reverse) and functions
+#define LN_DIRF(reverse, f0, f1, f2, f3, f4) \
+        ((uint8_t)(((reverse) ? 0x20u : 0u) | ((f0) ? 0x10u : 0u) | \
+        ((f4) ? 0x08u : 0u) | ((f3) ? 0x04u : 0u) | ((f2) ? 0x02u : 0u) | \
+        ((f1) ? 0x01u : 0u)))
+
+/**
+ * OPC_RQ_SL_DATA: request the data of a slot (answer: OPC_SL_RD_DATA)
+ * @param slot: the slot (0 ... 127)
+ */
+#define LN_RQ_SL_DATA_BYTES(slot) LN_BYTES4(OPC_RQ_SL_DATA, LN_LOW7(slot), 0u)
+#define LN_RQ_SL_DATA(slot) ((const uint8_t[])LN_RQ_SL_DATA_BYTES(slot))
+
+/**
+ * OPC_LONG_ACK: answer to a LN message
+ * @param opcode: the opcode of the LN message that is answered
+ * @param ack: the answer (ACK1)
+ */
+#define LN_LONG_ACK_BYTES(opcode, ack) \
+        LN_BYTES4(OPC_LONG_ACK, LN_LOW7(opcode), LN_LOW7(ack))
+#define LN_LONG_ACK(opcode, ack) ((const uint8_t[])LN_LONG_ACK_BYTES(opcode, ack))
+
+/**
+ * OPC_WR_SL_DATA: write the data of a slot (14 bytes)
+ * @param slot, stat1, adr, spd, dirf, trk, ss2, adr2, snd, id1, id2: the
+ * fields of the slot (7 bits each)
+ */
+#define LN_WR_SL_DATA_BYTES(slot, stat1, adr, spd, dirf, trk, ss2, adr2, snd, id1, id2) \
+        { OPC_WR_SL_DATA, 0x0eu, LN_LOW7(slot), LN_LOW7(stat1), LN_LOW7(adr), \
+        LN_LOW7(spd), LN_LOW7(dirf), LN_LOW7(trk), LN_LOW7(ss2), LN_LOW7(adr2), \
+        LN_LOW7(snd), LN_LOW7(id1), LN_LOW7(id2), \
+        (uint8_t)(0xffu ^ OPC_WR_SL_DATA ^ 0x0eu ^ LN_LOW7(slot) ^ LN_LOW7(stat1) ^ \
+        LN_LOW7(adr) ^ LN_LOW7(spd) ^ LN_LOW7(dirf) ^ LN_LOW7(trk) ^ LN_LOW7(ss2) ^ \
+        LN_LOW7(adr2) ^ LN_LOW7(snd) ^ LN_LOW7(id1) ^ LN_LOW7(id2)) }
+#define LN_WR_SL_DATA(slot, stat1, adr, spd, dirf, trk, ss2, adr2, snd, id1, id2) \
+        ((const uint8_t[])LN_WR_SL_DATA_BYTES(slot, stat1, adr, spd, dirf, trk, \
+        ss2, adr2, snd, id1, id2))
+
+/**
+ * OPC_PEER_XFER: 8 data bytes for a peer (16 bytes), the msb of the data
+ * bytes is moved to PXCT1 and PXCT2
+ * @param src: the source (7 bits)
+ * @param dst: the destination (14 bits: DSTL, DSTH)
+ * @param d1 ... d8: the data bytes
+ */
+#define LN_PEER_XFER_PXCT1(d1, d2, d3, d4) \
+        ((uint8_t)(LN_MSB(d1, 0) | LN_MSB(d2, 1) | LN_MSB(d3, 2) | LN_MSB(d4, 3)))
+#define LN_PEER_XFER_BYTES(src, dst, d1, d2, d3, d4, d5, d6, d7, d8) \
+        { OPC_PEER_XFER, 0x10u, LN_LOW7(src), LN_LOW7(dst), LN_LOW7((dst) >> 7), \
+        LN_PEER_XFER_PXCT1(d1, d2, d3, d4), LN_LOW7(d1), LN_LOW7(d2), LN_LOW7(d3), \
+        LN_LOW7(d4), LN_PEER_XFER_PXCT1(d5, d6, d7, d8), LN_LOW7(d5), LN_LOW7(d6), \
+        LN_LOW7(d7), LN_LOW7(d8), \
+        (uint8_t)(0xffu ^ OPC_PEER_XFER ^ 0x10u ^ LN_LOW7(src) ^ LN_LOW7(dst) ^ \
+        LN_LOW7((dst) >> 7) ^ LN_PEER_XFER_PXCT1(d1, d2, d3, d4) ^ \
+        LN_PEER_XFER_PXCT1(d5, d6, d7, d8) ^ LN_LOW7(d1) ^ LN_LOW7(d2) ^ \
+        LN_LOW7(d3) ^ LN_LOW7(d4) ^ LN_LOW7(d5) ^ LN_LOW7(d6) ^ LN_LOW7(d7) ^ \
+        LN_LOW7(d8)) }
+#define LN_PEER_XFER(src, dst, d1, d2, d3, d4, d5, d6, d7, d8) \
+        ((const uint8_t[])LN_PEER_XFER_BYTES(src, dst, d1, d2, d3, d4, d5, d6, \
+        d7, d8))
+
+// </editor-fold>
+
+#endif	/* LN_MESSAGE_H */
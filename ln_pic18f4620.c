@@ -0,0 +1,393 @@
+/*
+ * file: ln_pic18f4620.c
+ * author: Geert Giebens, Jan van Hooydonk
+ * comments: LocoNet driver - hardware hooks of the PIC18F4620
+ *
+ */
+
+#include "ln_pic18f4620.h"
+
+const lnPortHal_t lnPic18f4620Hal =
+{
+    lnPic18f4620Init,
+    lnPic18f4620IsLineFree,
+    lnPic18f4620WriteTx,
+    lnPic18f4620SetBRG,
+    lnPic18f4620SetLinebreak,
+    lnPic18f4620StartTimer,
+    lnPic18f4620StopTimer,
+    lnPic18f4620WakeTimer,
+    lnPic18f4620LockIsr,
+    lnPic18f4620UnlockIsr,
+    lnPic18f4620SetLed,
+#if LN_TIME
+    lnPic18f4620GetTime,
+#endif
+#if LN_TRACE
+    lnPic18f4620GetMicros,
+#endif
+};
+
+lnPort_t lnPort = { .hal = &lnPic18f4620Hal };
+
+// <editor-fold defaultstate="collapsed" desc="initialisation">
+
+/**
+ * initialise the hardware of the LN port (called by lnInit)
+ * @param port: the LN port
+ */
+void lnPic18f4620Init(lnPort_t* port)
+{
+    // initialisation of the elements (comparator, EUSART, timers, ISR, leds)
+    lnInitComparator();
+    lnInitEusart();
+    lnInitTmr1();
+#if LN_TIMEBASE
+    port->timeEpoch = 0;
+    lnInitTmr3();
+#endif
+    lnInitIsr();
+    lnInitLeds();
+}
+
+void lnInitComparator(void)
+{
+    CMCON = 0b00000001;         // one indipendent comparator with output
+                                // C1 Vin- = RA0
+                                // C1 Vin+ = RA3
+                                // C1 Vout = RA4
+    TRISAbits.RA4 = false;      // PORTA 4 = comparator output
+    return;
+}
+
+void lnInitEusart(void)
+{
+    // set pins for EUSART RX and TX
+    TRISCbits.RC6 = false;      // PORTC 6 = LN TX
+    TRISCbits.RC7 = true;       // PORTC 7 = LN RX
+
+    // configure EUSART
+    lnPic18f4620SetBRG(0);
+    BAUDCONbits.BRG16 = true;   // 16-bit baudrate generator
+    BAUDCONbits.TXCKP = true;   // invert TX output signal
+    TXSTAbits.SYNC = false;     // asynchronous mode
+    TXSTAbits.BRGH = false;     // low speed
+    TXSTAbits.TXEN = true;      // enable transmitter
+    RCSTAbits.CREN = false;     // clear bit CREN to clear the OERR bit
+    RCSTAbits.CREN = true;      // enable receiver
+    (void)RCREG;                // read the receive register to clear his
+                                // content and to clear the FERR bit
+    RCSTAbits.SPEN = true;      // enable serial port
+    return;
+}
+
+void lnInitTmr1(void)
+{
+    TMR1H = 0x00;               // reset timer1
+    TMR1L = 0x00;
+    T1CON = 0b00110000;         // RD16 = 0 (timer1 in 8 bit operation)
+                                // T1RUN = 0 (driven by another source)
+                                // T1CKPS = 0b11 (1:8 prescaler)
+                                // T1OSCEN = 0 (oscillator is disabled)
+                                // T1SYNC = 0 (ignored)
+                                // TMR1CS = 0 (source: internal clock = FOSC/4)
+                                // TMR1ON = 0 (timer1 is disabled)
+    return;
+}
+
+#if LN_TIMEBASE
+void lnInitTmr3(void)
+{
+    // timer 3 is the free-running timebase of the latency instrumentation
+    // and of the trace capture
+    TMR3H = 0x00;               // reset timer3
+    TMR3L = 0x00;
+    T3CON = 0b00110001;         // RD16 = 0 (timer3 in 8 bit operation)
+                                // T3CCP = 0b00 (timer1 is the CCP clock)
+                                // T3CKPS = 0b11 (1:8 prescaler = 1s)
+                                // T3SYNC = 0 (ignored)
+                                // TMR3CS = 0 (source: internal clock = FOSC/4)
+                                // TMR3ON = 1 (timer3 is enabled)
+    IPR2bits.TMR3IP = 0;        // timer3 interrupt low priority
+    PIE2bits.TMR3IE = 1;        // enable timer 3 overflow interrupt
+    return;
+}
+#endif
+
+void lnInitIsr(void)
+{
+    IPR1bits.TMR1IP = 0;        // timer1 interrupt low priority
+    IPR1bits.RCIP = 1;          // rxd interrupt high priority (top half)
+    LN_SWI_IP = 0;              // software interrupt low priority (bottom
+                                // half, only the top half sets the flag)
+    RCONbits.IPEN = 1;          // enable priority levels on iterrupt
+    INTCONbits.GIEH = 1;        // enable all high priority interrupts
+    INTCONbits.GIEL = 1;        // enable all low priority interrupts
+    PIE1bits.RCIE = 1;          // enable rxd interrupt
+    LN_SWI_IE = 1;              // enable the bottom half interrupt
+    PIE1bits.TMR1IE = 1;        // enable timer 1 overflow interrupt
+    return;
+}
+
+void lnInitLeds(void)
+{
+    TRISAbits.RA5 = 0;          // A5 as output
+    LATAbits.LATA5 = 1;         // led 'data on LN' off (active low)
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="ISR">
+
+// the interrupt vectors serve the LN port of the firmware (lnPort)
+void __interrupt(high_priority) lnIsrHigh(void)
+{
+    lnPic18f4620IsrHigh(&lnPort);
+}
+
+void __interrupt(low_priority) lnIsr(void)
+{
+    lnPic18f4620IsrLow(&lnPort);
+}
+
+/**
+ * top half: the only high interrupt trigger is the EUSART data receiver, the
+ * top half empties the receive FIFO as fast as possible, so no byte is lost
+ * whatever the low priority interrupts of the application do
+ * @param port: the LN port
+ */
+void lnPic18f4620IsrHigh(lnPort_t* port)
+{
+    if (PIE1bits.RCIE && PIR1bits.RCIF)
+    {
+        while (PIR1bits.RCIF)
+        {
+            // the FERR bit belongs to the byte on top of the FIFO, reading
+            // RCREG clears it
+            uint8_t event = RCSTAbits.FERR ? LN_RAW_FERR : LN_RAW_DATA;
+            pushRaw(port, RCREG, event);
+        }
+        if (RCSTAbits.OERR)
+        {
+            // EUSART receiver overrun (a byte is lost)
+            // clear bit CREN to clear the OERR bit and re-enable the receiver
+            RCSTAbits.CREN = false;
+            RCSTAbits.CREN = true;
+            pushRaw(port, 0, LN_RAW_OERR);
+        }
+        // trigger the bottom half
+        LN_SWI_IF = 1;
+    }
+}
+
+/**
+ * there are two possible low interrupt triggers, coming from the bottom
+ * half of the EUSART data receiver and/or coming from the timer 1 overrun
+ * flag (and the timer 3 overrun flag of the latency timebase)
+ * @param port: the LN port
+ */
+void lnPic18f4620IsrLow(lnPort_t* port)
+{
+    if (PIE1bits.TMR1IE && PIR1bits.TMR1IF)
+    {
+        // timer 1 interrupt
+        // clear the interrupt flag and handle the request
+        PIR1bits.TMR1IF = 0;
+        lnIsrTmr1(port);
+    }
+#if LN_TIMEBASE
+    else if (PIE2bits.TMR3IE && PIR2bits.TMR3IF)
+    {
+        // timer 3 interrupt (every 65.536ms), extend the timebase with the
+        // overflows of timer 3
+        PIR2bits.TMR3IF = 0;
+        port->timeEpoch++;
+    }
+#endif
+    else if (LN_SWI_IE && LN_SWI_IF)
+    {
+        // bottom half of the EUSART RC interupt
+        LN_SWI_IF = 0;
+        lnIsrRaw(port);
+    }
+}
+
+// </editor-fold>
+
+// <editor-fold defaultstate="collapsed" desc="hardware hooks">
+
+/**
+ * check if the LocoNet is free (to use)
+ * @param port: the LN port
+ * @return true: if the line is free, false: if the line is occupied
+ */
+bool lnPic18f4620IsLineFree(lnPort_t* port)
+{
+    // check if:
+    //  RC7 = 1 (PORT C, bit 7 = high)
+    //  RCIDL = 1 (receiver is idle = no data reception in progress)
+    return (PORTCbits.RC7 && BAUDCONbits.RCIDL);
+}
+
+/**
+ * transmit a byte
+ * @param port: the LN port
+ * @param value: the byte
+ */
+void lnPic18f4620WriteTx(lnPort_t* port, uint8_t value)
+{
+    TXREG = value;
+}
+
+/**
+ * sets and initialise the value of the bautrate generator
+ * @param port: the LN port
+ */
+void lnPic18f4620SetBRG(lnPort_t* port)
+{
+    SPBRGH = 0;                 // baudrate = 16.666
+    SPBRG = 119u;               // ((32.000.000 / 16.666) / 16) - 1 = 119 (0x77)
+}
+
+/**
+ * start or end a linebreak
+ * @param port: the LN port
+ * @param on: true: stop the EUSART and pull LN low, false: restore the
+ * output pin and (re-)enable the receiver
+ */
+void lnPic18f4620SetLinebreak(lnPort_t* port, bool on)
+{
+    if (on)
+    {
+        RCSTAbits.SPEN = false;     // stop EUSART
+        PORTCbits.RC6 = true;
+    }
+    else
+    {
+        RCSTAbits.SPEN = true;      // (re-)enable the receiver
+        PORTCbits.RC6 = false;      // and restore output pin
+    }
+}
+
+/**
+ * (re-)start timer 1 with a delay
+ * @param port: the LN port
+ * @param time: the delay in s
+ */
+void lnPic18f4620StartTimer(lnPort_t* port, uint16_t time)
+{
+    WRITETIMER1(~time);             // set delay in timer 1
+    T1CONbits.TMR1ON = 1;           // (re-)enable timer 1
+}
+
+/**
+ * stop timer 1
+ * @param port: the LN port
+ */
+void lnPic18f4620StopTimer(lnPort_t* port)
+{
+    T1CONbits.TMR1ON = 0;
+}
+
+/**
+ * start a stopped timer 1 and raise its interrupt right away (called with
+ * the interrupts disabled)
+ * @param port: the LN port
+ */
+void lnPic18f4620WakeTimer(lnPort_t* port)
+{
+    if (!T1CONbits.TMR1ON)
+    {
+        T1CONbits.TMR1ON = 1;
+        PIR1bits.TMR1IF = 1;
+    }
+}
+
+/**
+ * disable the interrupts (GIEH = 0 disables the high and the low priority
+ * interrupts), a caller that already disabled them keeps them disabled
+ * @param port: the LN port
+ * @return the previous state of GIEH
+ */
+uint8_t lnPic18f4620LockIsr(lnPort_t* port)
+{
+    uint8_t state = INTCONbits.GIEH;
+    INTCONbits.GIEH = 0;
+    return state;
+}
+
+/**
+ * restore the interrupts disabled by lnPic18f4620LockIsr
+ * @param port: the LN port
+ * @param state: the state returned by lnPic18f4620LockIsr
+ */
+void lnPic18f4620UnlockIsr(lnPort_t* port, uint8_t state)
+{
+    INTCONbits.GIEH = state;
+}
+
+/**
+ * turn the led 'data on LN' on or off
+ * @param port: the LN port
+ * @param on: true: led on
+ */
+void lnPic18f4620SetLed(lnPort_t* port, bool on)
+{
+    LATAbits.LATA5 = !on;           // active low
+}
+
+#if LN_TIME
+/**
+ * get the time of the free-running timebase (timer 3 + epoch)
+ * @param port: the LN port
+ * @return the time in units of 256s
+ */
+uint16_t lnPic18f4620GetTime(lnPort_t* port)
+{
+    uint8_t epoch;
+    uint8_t time;
+    do
+    {
+        // read again if the ISR updated the epoch in the meantime
+        epoch = port->timeEpoch;
+        time = TMR3H;
+    }
+    while (epoch != port->timeEpoch);
+    if (PIR2bits.TMR3IF && time < 0x80)
+    {
+        // timer 3 overflowed, but the epoch is not updated yet
+        epoch++;
+    }
+    return ((uint16_t)epoch << 8) | time;
+}
+#endif
+
+#if LN_TRACE
+/**
+ * get the time of the free-running timebase in s (called by the top half,
+ * the epoch can not change meanwhile)
+ * @param port: the LN port
+ * @return the time in s (bits 23 ... 0)
+ */
+uint32_t lnPic18f4620GetMicros(lnPort_t* port)
+{
+    uint8_t epoch = port->timeEpoch;
+    uint8_t high;
+    uint8_t low;
+    do
+    {
+        // timer 3 runs in 8 bit mode, read again if TMR3L overflowed
+        high = TMR3H;
+        low = TMR3L;
+    }
+    while (high != TMR3H);
+    if (PIR2bits.TMR3IF && high < 0x80)
+    {
+        // timer 3 overflowed, but the epoch is not updated yet
+        epoch++;
+    }
+    return ((uint32_t)epoch << 16) | ((uint16_t)high << 8) | low;
+}
+#endif
+
+// </editor-fold>
@@ -0,0 +1,68 @@
+/*
+ * file: ln_pic18f4620.h
+ * author: Geert Giebens, Jan van Hooydonk
+ * comments: LocoNet driver - hardware hooks of the PIC18F4620
+ *
+ * the LN port on the EUSART (RC6 = LN TX, RC7 = LN RX), the comparator
+ * (RA0, RA3 -> RA4), timer 1 (driver timing), timer 3 (timebase of
+ * LN_LATENCY and LN_TRACE), the interrupt of timer 2 (software interrupt of
+ * the bottom half, see LN_SWI_IF) and the led 'data on LN' (RA5, active low)
+ *
+ * revision history:
+ *  v1.0 Creation (16/10/2026)
+ */
+
+// this is a guard condition so that contents of this file are not included
+// more than once
+#ifndef LN_PIC18F4620_H
+#define	LN_PIC18F4620_H
+
+#include "ln.h"
+
+// software interrupt of the bottom half: the interrupt flag of a peripheral
+// that is switched off, only the top half sets it. The default is timer 2,
+// an application that needs timer 2 (eg. the PWM of the CCP modules) defines
+// the three bits of an other unused peripheral, eg. the A/D converter:
+//  -DLN_SWI_IF=PIR1bits.ADIF -DLN_SWI_IE=PIE1bits.ADIE -DLN_SWI_IP=IPR1bits.ADIP
+#ifndef LN_SWI_IF
+#define LN_SWI_IF PIR1bits.TMR2IF
+#define LN_SWI_IE PIE1bits.TMR2IE
+#define LN_SWI_IP IPR1bits.TMR2IP
+#endif
+
+extern const lnPortHal_t lnPic18f4620Hal;
+
+// the LN port of the firmware (served by the interrupt vectors)
+extern lnPort_t lnPort;
+
+void lnPic18f4620Init(lnPort_t*);
+void lnInitComparator(void);
+void lnInitEusart(void);
+void lnInitTmr1(void);
+#if LN_TIMEBASE
+void lnInitTmr3(void);
+#endif
+void lnInitIsr(void);
+void lnInitLeds(void);
+
+void lnPic18f4620IsrHigh(lnPort_t*);
+void lnPic18f4620IsrLow(lnPort_t*);
+
+bool lnPic18f4620IsLineFree(lnPort_t*);
+void lnPic18f4620WriteTx(lnPort_t*, uint8_t);
+void lnPic18f4620SetBRG(lnPort_t*);
+void lnPic18f4620SetLinebreak(lnPort_t*, bool);
+void lnPic18f4620StartTimer(lnPort_t*, uint16_t);
+void lnPic18f4620StopTimer(lnPort_t*);
+void lnPic18f4620WakeTimer(lnPort_t*);
+uint8_t lnPic18f4620LockIsr(lnPort_t*);
+void lnPic18f4620UnlockIsr(lnPort_t*, uint8_t);
+void lnPic18f4620SetLed(lnPort_t*, bool);
+#if LN_TIME
+uint16_t lnPic18f4620GetTime(lnPort_t*);
+#endif
+#if LN_TRACE
+uint32_t lnPic18f4620GetMicros(lnPort_t*);
+#endif
+
+#endif	/* LN_PIC18F4620_H */
@@ -8,7 +8,8 @@
  */
 
 #include "config.h"
-#include "ln.h"
+#include "ln_pic18f4620.h"
+#include "ln_message.h"
 
 void main(void)
 {
@@ -25,7 +26,7 @@ void main(void)
     OSCTUNEbits.PLLEN = 1;    
     
     // init LN    
-    lnInit();
+    lnInit(&lnPort);
     
     TRISBbits.TRISB1 = 0; // A0 as output
     while (1)        
@@ -35,12 +36,10 @@ void main(void)
         LATBbits.LATB1 = 0;
         __delay_ms(50);
         
-        di();
-        enQueue(&lnTxQueue, 0xb2);
-        enQueue(&lnTxQueue, 0x00);
-        enQueue(&lnTxQueue, 0x00);
-        enQueue(&lnTxQueue, 0x4d);
-        ei();
+        // the LN TX queue is lock-free, the message is put on the queue
+        // as a whole without disabling the interrupts (the bytes and the
+        // checksum of the sensor report are constants)
+        lnSendBuiltMessage(&lnPort, LN_PRIORITY_NORMAL, LN_INPUT_REP(0u, false));
     }
     return;
     